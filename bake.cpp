@@ -1,11 +1,28 @@
 #include "bakelib.hpp"
+#include "bake_daemon.hpp"
+#include "bake_scheduler.hpp"
+#include "bake_stats.hpp"
+#include "bake_trace.hpp"
 #include "bake_utilities.hpp"
+#include "build_log.hpp"
+#include "depsnapshot.hpp"
+#include "file_watcher.hpp"
+#include "frozen_depsystem.hpp"
+#include "generator_cache.hpp"
+#include "generator_pipeline.hpp"
+#include "hash_cache.hpp"
+#include "jobserver.hpp"
+#include "stat_cache.hpp"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <fnmatch.h>
 #include <fstream>
 #include <functional>
-#include <ext/stdio_filebuf.h>
+#include <poll.h>
+#include <sstream>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -14,23 +31,693 @@
 using std::cerr;
 using std::cout;
 using std::cin;
+using std::atoi;
 using std::endl;
 using std::function;
 using std::getenv;
 using std::ifstream;
+using std::make_pair;
+using std::make_tuple;
+using std::ostringstream;
+using std::sort;
 //using std::setenv;
 using std::strcmp;
 using std::strlen;
+using std::strncmp;
 
-using __gnu_cxx::stdio_filebuf;
+//What bake remembers about previous runs, and where
+struct History
+{
+     bool hash_mode; //judge freshness by the contents of dependencies rather than their modification times
+     BuildLog build_log;
+     string log_path;
+     HashCache hash_cache;
+     string hashes_path;
+     StatCache files; //status of the files at log_path and hashes_path as of when we last read or wrote them
+};
+
+//Reads our log, and in --hash mode our hashes, unless they haven't changed since we last read or wrote them.
+static void load_history(History& history)
+{
+     if(history.files.refresh(history.log_path))
+          history.build_log.load(history.log_path);
+     if(history.hash_mode && history.files.refresh(history.hashes_path))
+          history.hash_cache.load(history.hashes_path);
+}
+
+/*Iteratively augments dep_tree by executing the commands in our Bakefile, as a GeneratorPipeline.
+  Reuses the output of commands from previous runs if use_cache is set; in -sub mode, the graph we were handed isn't part of what the cache remembers, so we can't.
+  A command which declared inputs can only reuse its output once every command before it has finished, so it waits for them; the rest start right away.
+  If every command's output was reused, the graph is the one they made last time, so it's loaded from the snapshot saved then instead of being parsed again.
+  The commands between "#bake-parallel" and "#bake-end" lines are each given only the graph from before them, and mustn't define any symbol differently.
+  A command preceded by a "#bake-binary" line is given the binary framing of the Baker Interchange Format, and told so.
+  The patterns of every "#bake-inputs" line are appended to generator_inputs.
+  Returns whether every command declared its inputs, so that the graph can only change when one of them does.*/
+static bool run_bakefile(DepSystem& dep_tree, const string& filename, bool use_cache, vector<string>& generator_inputs) throw(const char*)
+{
+     bake_stats::Phase phase("Bakefile");
+
+     //Open our Bakefile
+     ifstream fin(filename);
+
+     GeneratorCache generator_cache(GeneratorCache::path_for(filename));
+     ostringstream initial_graph;
+     bake_utilities::output_depsystem(initial_graph,dep_tree);
+     GeneratorPipeline pipeline(initial_graph.str());
+
+     /*Commands in the pipeline whose output we have yet to take, with their inputs, the fingerprint of those inputs from when the command was looked up in the cache,
+       whether their output came from the cache, and the number of the parallel group they're in, if any*/
+     queue<tuple<string,vector<string>,uint64_t,bool,unsigned>> pending;
+
+     //Values of the symbols defined so far by the commands of parallel group number definitions_group
+     bool grouped = false;
+     unsigned group_number = 0, definitions_group = 0;
+     unordered_map<string,string> group_definitions;
+     auto check_definition = [&group_definitions](const string& symname, const string& value)
+     {
+          auto existing = group_definitions.emplace(symname,value).first;
+          if(existing->second!=value)
+               throw StringFunctions::permanent_c_str(symname+": defined differently by commands of the same #bake-parallel group.");
+     };
+
+     auto parse = [&](const string& output, unsigned group)
+     {
+          bake_trace::Span span("parse","graph");
+          if(group)
+          {
+               if(group!=definitions_group)
+               {
+                    group_definitions.clear();
+                    definitions_group = group;
+               }
+               bake_utilities::augment_depsystem(output.data(),output.size(),dep_tree,[](string symname) noexcept { return symname; },check_definition);
+          }
+          else
+               bake_utilities::augment_depsystem(output.data(),output.size(),dep_tree);
+     };
+
+     /*While every command's output so far was reused, the graph may be in our snapshot, so we put off parsing it: these are that output, with the groups it came from.
+       Once a command has to be run, it's all parsed after all.*/
+     bool all_cached = use_cache, all_declared = true;
+     size_t command_count = 0;
+     vector<pair<string,unsigned>> deferred;
+     auto parse_deferred = [&]()
+     {
+          for(const pair<string,unsigned>& output : deferred)
+               parse(output.first,output.second);
+          deferred.clear();
+     };
+
+     auto take_output = [&]()
+     {
+          string output;
+          pipeline.next(output);
+          bool cached = std::get<3>(pending.front());
+          if(all_cached && cached)
+               deferred.push_back(make_pair(std::move(output),std::get<4>(pending.front())));
+          else
+          {
+               all_cached = false;
+               parse_deferred();
+               parse(output,std::get<4>(pending.front()));
+               if(!cached && use_cache)
+                    generator_cache.add(std::get<0>(pending.front()),std::get<1>(pending.front()),std::get<2>(pending.front()),output);
+          }
+          pending.pop();
+     };
+
+     vector<string> command_inputs;
+     bool command_binary = false;
+     while(fin.good())
+     {
+          string next_command = bake_utilities::get_command(fin);
+          if(next_command.find("#bake-inputs")==0)
+          {
+               StringFunctions::tokenize(command_inputs,next_command.substr(strlen("#bake-inputs")));
+               generator_inputs.insert(generator_inputs.end(),command_inputs.begin(),command_inputs.end());
+               continue;
+          }
+          if(next_command.find("#bake-binary")==0)
+          {
+               command_binary = true;
+               continue;
+          }
+          if(next_command.find("#bake-parallel")==0)
+          {
+               if(grouped)
+                    throw "#bake-parallel inside another #bake-parallel group.";
+
+               //The group's commands are looked up in the cache given what came before them, so that must be known.
+               while(use_cache && pending.size())
+                    take_output();
+               generator_cache.begin_group();
+               pipeline.begin_group();
+               grouped = true;
+               group_number++;
+               continue;
+          }
+          if(next_command.find("#bake-end")==0)
+          {
+               if(!grouped)
+                    throw "#bake-end without #bake-parallel.";
+               while(pending.size())
+                    take_output();
+               generator_cache.end_group();
+               pipeline.end_group();
+               grouped = false;
+               continue;
+          }
+          if(next_command=="\n" || next_command[0]=='#')
+               continue;
+
+          command_count++;
+          if(!command_inputs.size())
+               all_declared = false;
+          bool cached = false;
+          uint64_t inputs_fingerprint = 0;
+          if(use_cache && command_inputs.size())
+          {
+               while(!grouped && pending.size())
+                    take_output();
+
+               string output;
+               bake_trace::Time lookup_begin = std::chrono::steady_clock::now();
+               cached = generator_cache.find(next_command,command_inputs,inputs_fingerprint,output);
+               if(cached)
+               {
+                    bake_trace::record(bake_trace::command_name(next_command),"generator",lookup_begin,std::chrono::steady_clock::now(),0,{{"cached",1},{"output_bytes",output.size()}});
+                    pipeline.add_output(output);
+               }
+          }
+          if(!cached)
+               pipeline.add_command(next_command,command_binary);
+          pending.push(make_tuple(next_command,command_inputs,inputs_fingerprint,cached,grouped ? group_number : 0));
+          command_inputs.clear();
+          command_binary = false;
+     }
+     if(grouped)
+          throw "#bake-parallel group without #bake-end.";
+     while(pending.size())
+          take_output();
+     if(!use_cache) //a snapshot of a graph we were handed would be of no use next time
+          return all_declared;
+     generator_cache.prune();
+
+     bool loaded = false;
+     string snapshot_path = generator_cache.get_snapshot_path();
+     if(all_cached && command_count)
+     {
+          try
+          {
+               bake_trace::Span span("load snapshot","graph");
+               DepSnapshot snapshot(snapshot_path);
+               if(snapshot.get_tag()==generator_cache.get_fingerprint())
+               {
+                    bake_utilities::load_snapshot(snapshot,dep_tree);
+                    loaded = true;
+               }
+          }
+          catch(const char* e)
+          {
+               //No usable snapshot: parse the output after all.
+          }
+     }
+     if(loaded)
+          return all_declared;
+     parse_deferred();
+
+     //Only if every command declared its inputs can all of them be reused next time.
+     if(all_declared && command_count)
+     {
+          bake_trace::Span span("save snapshot","graph");
+          DepSnapshot::save(dep_tree,snapshot_path,generator_cache.get_fingerprint(),bake_utilities::restat_symbols);
+     }
+     return all_declared;
+}
+
+typedef FrozenDepSystem::Index Index;
+
+static uint64_t command_signature(const FrozenDepSystem& graph, Index symbol)
+{
+     const string& command = graph.get_value(symbol);
+     return HashCache::hash_bytes(command.data(),command.size());
+}
+
+//Fingerprints the names and contents of symbol's dependencies, in an order independent of how they were declared.
+static uint64_t inputs_signature(const FrozenDepSystem& graph, Index symbol, HashCache& hash_cache, StatCache& stat_cache)
+{
+     vector<const char*> dependencies;
+     for(auto edges = graph.get_dependency_edges(symbol); edges.first!=edges.second; ++edges.first)
+          dependencies.push_back(graph.get_name(*edges.first));
+     sort(dependencies.begin(),dependencies.end(),[](const char* left, const char* right) { return strcmp(left,right) < 0; });
+     uint64_t to_return = 0;
+     for(const char* depname : dependencies)
+     {
+          uint64_t content_hash = hash_cache.get(depname,stat_cache);
+          to_return = HashCache::hash_bytes(depname,strlen(depname)+1,to_return);
+          to_return = HashCache::hash_bytes(&content_hash,sizeof(content_hash),to_return);
+     }
+     return to_return;
+}
+
+/*Returns the state symbol should have on its own account, rather than because of anything it depends on: NONBUILT, STALE, or VALID.
+  statuses holds the status of every symbol in graph, by index.
+  A target whose build command changed since it was last brought up to date is stale.
+  Otherwise, in --hash mode, a target whose dependencies' contents we fingerprinted when it was last brought up to date is stale exactly when that fingerprint changes.
+  Other targets, and all targets otherwise, are stale when a dependency was modified after them,
+  or, for a restat target its build left untouched, since that build found it up to date with them.*/
+static DepSystem::Symbol_State own_state(const FrozenDepSystem& graph, Index symbol, const vector<const StatCache::Status*>& statuses, StatCache& stat_cache, History& history)
+{
+     const StatCache::Status& sym_status = *statuses[symbol];
+     if(!sym_status.exists)
+          return DepSystem::NONBUILT;
+
+     //Targets without commands are source files, so if one's command went away, it's been made into one; there's nothing to rebuild.
+     const BuildLog::Entry* entry = history.build_log.find(graph.get_name(symbol));
+     if(entry && entry->command_signature && graph.get_value(symbol)!="" && command_signature(graph,symbol)!=entry->command_signature)
+          return DepSystem::STALE;
+
+     if(history.hash_mode && entry && entry->inputs_signature)
+          return inputs_signature(graph,symbol,history.hash_cache,stat_cache)==entry->inputs_signature ? DepSystem::VALID : DepSystem::STALE;
+
+     //See if any of our dependencies was modified after us, or, if our build last left us untouched, after it found us up to date with them.
+     StatCache::Status checked = sym_status;
+     if(entry)
+          checked.mtime = entry->checked_mtime;
+     const StatCache::Status& up_to_date = checked.newer_than(sym_status) ? checked : sym_status;
+     for(auto edges = graph.get_dependency_edges(symbol); edges.first!=edges.second; ++edges.first)
+     {
+          const StatCache::Status& dep_status = *statuses[*edges.first];
+          if(dep_status.exists && dep_status.newer_than(up_to_date))
+               return DepSystem::STALE;
+     }
+     return DepSystem::VALID;
+}
+
+/*If symbol is out of date on its own account, marks it so, adds it to out_of_date, and returns true.
+  Its dependents are left for the caller to invalidate, all at once.*/
+static bool check_freshness(FrozenDepSystem& graph, Index symbol, const vector<const StatCache::Status*>& statuses, StatCache& stat_cache, History& history, unordered_set<string>& out_of_date)
+{
+     DepSystem::Symbol_State state = own_state(graph,symbol,statuses,stat_cache,history);
+     if(state==DepSystem::VALID)
+          return false;
+     graph.set_state(symbol,state);
+     out_of_date.insert(graph.get_name(symbol));
+     return true;
+}
+
+/*Freezes dep_tree, whose symbols are those in symbols, into graph, and then, starting with every symbol valid, stats every target, setting graph's symbol states accordingly.
+  The status of every symbol is put in statuses, by index, and targets stale on their own account, rather than only because something they depend on is, are also put in out_of_date.*/
+static void check_all(const DepSystem& dep_tree, FrozenDepSystem& graph, const vector<string>& symbols, StatCache& stat_cache, vector<const StatCache::Status*>& statuses, History& history,
+                      unordered_set<string>& out_of_date)
+{
+     bake_stats::Phase phase("freshness");
+     {
+          bake_trace::Span span("freeze","freshness");
+          graph = dep_tree.freeze();
+     }
+     Index symbol_count = graph.get_symbol_count();
+     for(Index i=0; i<symbol_count; i++)
+          graph.set_state(i,DepSystem::VALID);
+
+     {
+          bake_trace::Span span("stat","freshness");
+          stat_cache.prefetch(symbols);
+          statuses.clear();
+          statuses.reserve(symbol_count);
+          for(Index i=0; i<symbol_count; i++)
+               statuses.push_back(&stat_cache.get(graph.get_name(i)));
+     }
+     if(history.hash_mode)
+     {
+          bake_trace::Span span("hash","freshness");
+          vector<bool> needed(symbol_count,false); //a dependency shared by several targets is hashed once
+          for(Index i=0; i<symbol_count; i++)
+          {
+               const BuildLog::Entry* entry = history.build_log.find(graph.get_name(i));
+               if(entry && entry->inputs_signature)
+                    for(auto edges = graph.get_dependency_edges(i); edges.first!=edges.second; ++edges.first)
+                         needed[*edges.first] = true;
+          }
+          vector<string> to_hash;
+          for(Index i=0; i<symbol_count; i++)
+               if(needed[i])
+                    to_hash.push_back(graph.get_name(i));
+          history.hash_cache.prefetch(to_hash,stat_cache);
+     }
+
+     bake_trace::Span span("check freshness","freshness");
+     vector<Index> stale;
+     for(Index i=0; i<symbol_count; i++)
+          if(check_freshness(graph,i,statuses,stat_cache,history,out_of_date))
+               stale.push_back(i);
+     graph.invalidate_dependents(stale);
+}
+
+/*Builds target, or everything if target is "", putting the symbols we planned to build in to_build and the names of those built (or skipped) in built.
+  Remembers how long everything took for next time, even if we fail.
+  Also remembers the command of every target now up to date (those we built or skipped, and those which were already fresh), and, in --hash mode, its signature.*/
+static void build(FrozenDepSystem& graph, const string& target, const unordered_set<string>& out_of_date, Jobserver& jobserver, History& history,
+                  vector<Index>& to_build, unordered_set<string>& built) throw(const char*)
+{
+     Index symbol_count = graph.get_symbol_count();
+
+     //Work out our build plan
+     bake_trace::Time plan_begin = std::chrono::steady_clock::now();
+     {
+          bake_stats::Phase phase("plan");
+          if(target!="")
+          {
+               Index target_symbol = graph.find_symbol(target);
+               if(target_symbol==FrozenDepSystem::NOT_FOUND)
+                    throw "get_build_plan() called with nonexistent sym name.";
+               to_build = graph.get_build_plan(target_symbol);
+          }
+          else
+               for(Index i=0; i<symbol_count; i++)
+               {
+                    DepSystem::Symbol_State state = graph.get_state(i);
+                    if(state==DepSystem::INVALID)
+                         throw "get_build_plan() called with unbuildable symbol.";
+                    if(state==DepSystem::NONBUILT || state==DepSystem::STALE)
+                         to_build.push_back(i);
+               }
+     }
+     bake_trace::record("plan","build",plan_begin,std::chrono::steady_clock::now(),0,{{"targets",to_build.size()}});
+
+     auto record_history = [&]()
+     {
+          bake_trace::Span span("record history","build");
+          bake_stats::Phase phase("record history");
+          vector<bool> planned(symbol_count,false), done(symbol_count,false);
+          for(Index symbol : to_build)
+               planned[symbol] = true;
+          for(const string& symname : built)
+               done[graph.find_symbol(symname)] = true;
+          vector<Index> up_to_date;
+          for(Index i=0; i<symbol_count; i++)
+               if(done[i] || (!planned[i] && graph.get_state(i)==DepSystem::VALID))
+               {
+                    if(graph.get_value(i)!="")
+                         history.build_log.set_command_signature(graph.get_name(i),command_signature(graph,i));
+                    auto edges = graph.get_dependency_edges(i);
+                    if(edges.first!=edges.second)
+                         up_to_date.push_back(i);
+               }
+
+          if(history.hash_mode)
+          {
+               //Our builds modified files, so stat everything again.
+               StatCache post_build_stats;
+               vector<bool> needed(symbol_count,false);
+               for(Index symbol : up_to_date)
+                    for(auto edges = graph.get_dependency_edges(symbol); edges.first!=edges.second; ++edges.first)
+                         needed[*edges.first] = true;
+               vector<string> to_hash;
+               for(Index i=0; i<symbol_count; i++)
+                    if(needed[i])
+                         to_hash.push_back(graph.get_name(i));
+               post_build_stats.prefetch(to_hash);
+               history.hash_cache.prefetch(to_hash,post_build_stats);
+               for(Index symbol : up_to_date)
+                    history.build_log.set_inputs_signature(graph.get_name(symbol),inputs_signature(graph,symbol,history.hash_cache,post_build_stats));
+               history.hash_cache.save(history.hashes_path);
+               history.files.refresh(history.hashes_path);
+          }
+          history.build_log.save(history.log_path);
+          history.files.refresh(history.log_path);
+     };
+
+     try
+     {
+          bake_stats::Phase phase("build");
+          bake_scheduler::build(graph,to_build,out_of_date,jobserver,history.build_log,[&built](string symname) noexcept { built.insert(symname); });
+     }
+     catch(const char* e)
+     {
+          record_history();
+          bake_trace::save();
+          bake_stats::report(cerr);
+          throw;
+     }
+     record_history();
+     bake_trace::save();
+     bake_stats::report(cerr);
+}
+
+//Returns whether path is matched by pattern, as given on a "#bake-inputs" line.  A directory matches what's directly in it.
+static bool input_matches(const string& pattern, const string& path)
+{
+     if(fnmatch(pattern.c_str(),path.c_str(),FNM_PATHNAME)==0)
+          return true;
+     size_t slash = path.rfind('/');
+     if(slash==string::npos)
+          return false;
+     string directory = path.substr(0,slash);
+     return fnmatch(pattern.c_str(),directory.c_str(),FNM_PATHNAME)==0 || fnmatch(pattern.c_str(),(directory+"/").c_str(),FNM_PATHNAME)==0;
+}
+
+//The graph, kept in memory and up to date as files change, by --watch and --daemon
+struct Resident
+{
+     FileWatcher watcher;
+     DepSystem dep_tree;
+     FrozenDepSystem graph; //dep_tree, frozen once the Bakefile has run
+     vector<string> symbols, generator_inputs;
+     StatCache stat_cache;
+     vector<const StatCache::Status*> statuses; //as from check_all()
+     unordered_set<string> out_of_date; //as from check_all(), plus whatever we didn't manage to build
+     bool reload = true; //whether the Bakefile must be run again
+     bool inputs_declared = false; //whether every Bakefile command declared its inputs, so that we know when to run it again
+};
+
+/*If resident.reload is set, runs the Bakefile again and checks everything.
+  Throws exception, leaving the graph empty and reload set, if the Bakefile fails.*/
+static void load(Resident& resident, const string& filename, History& history) throw(const char*)
+{
+     if(!resident.reload)
+          return;
 
-//Usage: bake, bake -sub dir, bake target
+     resident.graph = FrozenDepSystem();
+     resident.dep_tree.clear();
+     bake_utilities::restat_symbols.clear();
+     resident.symbols.clear();
+     resident.generator_inputs.clear();
+     resident.out_of_date.clear();
+     resident.statuses.clear();
+     resident.stat_cache = StatCache();
+     resident.watcher.watch_parent(filename);
+     try
+     {
+          resident.inputs_declared = run_bakefile(resident.dep_tree,filename,true,resident.generator_inputs);
+     }
+     catch(const char* e)
+     {
+          resident.dep_tree.clear();
+          throw;
+     }
+
+     resident.symbols = resident.dep_tree.get_symbols();
+     check_all(resident.dep_tree,resident.graph,resident.symbols,resident.stat_cache,resident.statuses,history,resident.out_of_date);
+     resident.reload = false;
+}
+
+//Builds target (or everything if it's "") in resident's graph, then brings the graph up to date with what was and wasn't built.  Throws exception if the build fails.
+static void build_resident(Resident& resident, const string& target, Jobserver& jobserver, History& history) throw(const char*)
+{
+     vector<Index> to_build;
+     unordered_set<string> built;
+     const char* failure = NULL;
+     try
+     {
+          build(resident.graph,target,resident.out_of_date,jobserver,history,to_build,built);
+     }
+     catch(const char* e)
+     {
+          failure = e;
+     }
+
+     //Whatever we didn't get to is still out of date.  (A target whose build failed was marked valid when its build started.)
+     unordered_set<string> still_out_of_date;
+     for(const string& symname : resident.out_of_date)
+          if(!built.count(symname))
+               still_out_of_date.insert(symname);
+     for(Index symbol : to_build)
+     {
+          const char* symname = resident.graph.get_name(symbol);
+          if(!built.count(symname))
+          {
+               if(resident.graph.get_state(symbol)==DepSystem::VALID)
+                    resident.graph.set_state(symbol,DepSystem::STALE);
+               still_out_of_date.insert(symname);
+          }
+     }
+     resident.out_of_date.swap(still_out_of_date);
+
+     //Take note of what we built, so we don't mistake it for a change, and watch any directories our builds created.
+     for(const string& symname : built)
+          resident.stat_cache.refresh(symname);
+     for(const string& pattern : resident.generator_inputs)
+          resident.watcher.watch_parent(pattern);
+     for(const string& symname : resident.symbols)
+          resident.watcher.watch_parent(symname);
+
+     if(failure)
+          throw failure;
+}
+
+/*Takes in the files in changed, reported by resident's watcher, which also reported whether it saw every change.
+  Only the targets depending on what changed are checked again, and a change which leaves a file's status as we last saw it (such as one made by our own build) is ignored.
+  If the Bakefile, or anything its commands declared with "#bake-inputs", changed, sets resident.reload instead.
+  Returns whether anything in the graph may have changed.*/
+static bool take_changes(Resident& resident, const string& filename, History& history, const unordered_set<string>& changed, bool complete)
+{
+     if(!complete || changed.count(filename))
+          resident.reload = true;
+     for(const string& path : changed)
+          for(const string& pattern : resident.generator_inputs)
+               if(input_matches(pattern,path))
+                    resident.reload = true;
+     if(resident.reload)
+          return true;
+
+     bool changes = false;
+     vector<Index> stale;
+     for(const string& path : changed)
+     {
+          Index symbol = resident.graph.find_symbol(path);
+          if(symbol!=FrozenDepSystem::NOT_FOUND && resident.stat_cache.refresh(path))
+          {
+               changes = true;
+               if(check_freshness(resident.graph,symbol,resident.statuses,resident.stat_cache,history,resident.out_of_date))
+                    stale.push_back(symbol);
+               for(auto dependents = resident.graph.get_direct_dependents(symbol); dependents.first!=dependents.second; ++dependents.first)
+                    if(check_freshness(resident.graph,*dependents.first,resident.statuses,resident.stat_cache,history,resident.out_of_date))
+                         stale.push_back(*dependents.first);
+          }
+     }
+     resident.graph.invalidate_dependents(stale);
+     return changes;
+}
+
+/*Builds, then keeps the graph in memory and builds again whenever a file in it changes, forever.
+  Failures are reported, and then we wait for the change that fixes them.*/
+static void watch(const string& filename, const string& target, Jobserver& jobserver, History& history) throw(const char*)
+{
+     Resident resident;
+     while(true)
+     {
+          try
+          {
+               load(resident,filename,history);
+               build_resident(resident,target,jobserver,history);
+          }
+          catch(const char* e)
+          {
+               cerr << e << endl;
+          }
+
+          //Wait until something we care about changes.
+          cerr << "bake: watching for changes" << endl;
+          bool changes = false;
+          while(!changes)
+          {
+               unordered_set<string> changed;
+               bool complete = resident.watcher.wait(changed);
+               changes = take_changes(resident,filename,history,changed,complete);
+          }
+     }
+}
+
+/*Keeps the graph in memory as --watch does, but builds only when a client asks, forever.
+  Clients run in our directory with nothing but a target have their builds run by us;
+  anything else is sent back to build for itself, since we couldn't do as it asked.
+  Unless every Bakefile command declared its inputs, any file may change what they output, so we run the Bakefile again for every build.*/
+static void serve(const string& filename, Jobserver& jobserver, History& history) throw(const char*)
+{
+     Resident resident;
+     string socket_path = bake_daemon::socket_path(filename);
+     int listen_fd = bake_daemon::listen(socket_path);
+     char* real_directory = realpath(".",NULL);
+     string our_directory = real_directory ? real_directory : "";
+     free(real_directory);
+
+     try
+     {
+          load(resident,filename,history);
+     }
+     catch(const char* e)
+     {
+          cerr << e << endl;
+     }
+     cerr << "bake: serving on " << socket_path << endl;
+
+     while(true)
+     {
+          pollfd poll_fds[2] = {{listen_fd,POLLIN,0},{resident.watcher.get_fd(),POLLIN,0}};
+          if(poll(poll_fds,2,-1)==-1)
+          {
+               if(errno==EINTR)
+                    continue;
+               throw "poll() failed while serving.";
+          }
+          //Clients we send back to build for themselves rewrite our log and hashes, so read them again before judging anything by them.
+          load_history(history);
+          if(poll_fds[1].revents)
+          {
+               unordered_set<string> changed;
+               bool complete = resident.watcher.wait(changed,0);
+               take_changes(resident,filename,history,changed,complete);
+          }
+
+          bake_daemon::Request request;
+          if(!poll_fds[0].revents || !bake_daemon::receive(listen_fd,request))
+               continue;
+
+          real_directory = realpath(request.working_directory.c_str(),NULL);
+          bool ours = real_directory && our_directory==real_directory && request.arguments.size()<=1 && (!request.arguments.size() || request.arguments[0][0]!='-');
+          free(real_directory);
+          if(!ours)
+          {
+               bake_daemon::reply(request,false,0);
+               continue;
+          }
+
+          //Take in whatever the client changed right before asking, so that we build what it sees.
+          bake_daemon::enter(request);
+          int exit_status = 0;
+          try
+          {
+               unordered_set<string> changed;
+               bool complete = resident.watcher.wait(changed,0,0);
+               take_changes(resident,filename,history,changed,complete);
+               if(!resident.inputs_declared)
+                    resident.reload = true;
+               load(resident,filename,history);
+               build_resident(resident,request.arguments.size() ? request.arguments[0] : "",jobserver,history);
+          }
+          catch(const char* e)
+          {
+               cerr << e << endl;
+               exit_status = 1;
+          }
+          bake_daemon::leave();
+          bake_daemon::reply(request,true,exit_status);
+     }
+}
+
+//Usage: bake, bake -sub dir, bake target, bake -j N target, bake --hash target, bake --watch target, bake --daemon, bake --trace file target, bake --stats target
 int main(int argc, char** argv)
 {
      //Command line parameters
      string target = "";
      string subdir = "";
      string filename = "Bakefile";
+     int max_jobs = 0; //0 means not given
+     bool hash_mode = false; //judge freshness by the contents of dependencies rather than their modification times
+     bool watch_mode = false; //keep building as files change
+     bool daemon_mode = false; //keep the graph up to date as files change, building for clients
+     string trace_path = ""; //where to write a timeline of what we did, if anywhere
 
      //Parse our command line
      int i=1;
@@ -44,9 +731,35 @@ int main(int argc, char** argv)
                     i++;
                     filename=argv[i];
                }
+               else if(strncmp(argv[i],"-j",2)==0)
+               {
+                    const char* jobs_arg = argv[i]+2;
+                    if(*jobs_arg=='\0')
+                    {
+                         if(i+1==argc) throw i;
+                         i++;
+                         jobs_arg=argv[i];
+                    }
+                    max_jobs=atoi(jobs_arg);
+                    if(max_jobs<1) throw i;
+               }
+               else if(strcmp(argv[i],"--hash")==0)
+                    hash_mode=true;
+               else if(strcmp(argv[i],"--watch")==0)
+                    watch_mode=true;
+               else if(strcmp(argv[i],"--daemon")==0)
+                    daemon_mode=true;
+               else if(strcmp(argv[i],"--stats")==0)
+                    bake_stats::enabled=true;
+               else if(strcmp(argv[i],"--trace")==0)
+               {
+                    if(i+1==argc || trace_path!="") throw i;
+                    i++;
+                    trace_path=argv[i];
+               }
                else if(strcmp(argv[i],"-sub")==0 || subdir!="")
                {
-                    if(i+1==argc) throw i;
+                    if(i+1==argc || watch_mode || daemon_mode) throw i;
                     i++;
                     subdir=argv[i];
                }
@@ -64,14 +777,32 @@ int main(int argc, char** argv)
           cerr << argv[0] << ": Invalid invocation at parameter " << x << endl;
           return 1;
      }
+     if(daemon_mode && (watch_mode || target!=""))
+     {
+          cerr << argv[0] << ": --daemon builds only what its clients ask for" << endl;
+          return 1;
+     }
+
+     //If a daemon serves our tree, it can build for us, unless we were asked for something it wasn't started with.
+     int daemon_exit_status;
+     if(subdir=="" && !max_jobs && !hash_mode && !watch_mode && !daemon_mode && trace_path=="" && !bake_stats::enabled && bake_daemon::forward(bake_daemon::socket_path(filename),argc,argv,daemon_exit_status))
+          return daemon_exit_status;
 
 try {
      /*Okay, we've parsed our command line.
        Now, let's get cracking.*/
+     if(trace_path!="")
+          bake_trace::start(trace_path);
 
      //Create our DepSystem
      DepSystem dep_tree;
 
+     /*Share the jobserver of the make or bake which invoked us, unless we were told how many jobs to run.
+       Otherwise, run our own, so that the bakes and makes our Bakefile and build commands run share our slots.*/
+     Jobserver jobserver;
+     if(max_jobs || !jobserver.join())
+          jobserver.serve(max_jobs ? max_jobs : sysconf(_SC_NPROCESSORS_ONLN));
+
      //If we were called with -sub, do initial sub processing.
      if(subdir!="")
      {
@@ -89,7 +820,7 @@ try {
                cerr << argv[0] << ": " << subdir << ": Not a directory.\n";
                return 1;
           }
-          
+
           //Change our working directory to subdir
           /*Note that any use of setenv causes a memory leak, but it's okay
             since we only change our directory once.  Use putenv if you
@@ -99,119 +830,12 @@ try {
           //Construct initial depsystem by reading dep_tree from standard in
           //Mutate dep_tree by prefacing symbols with "../"
           bakelib::construct_depsystem(dep_tree,[](string symname) noexcept { return string("../")+symname; });
-     }
-
-     //Open our Bakefile
-     ifstream fin(filename);
-
-     //Iteratively augment dep_tree by executing commands in Bakefile
-     while(fin.good())
-     {
-          string next_command = bake_utilities::get_command(fin);
-          if(next_command=="\n" || next_command[0]=='#')
-               continue;
-          pair<int,pid_t> cmd_result = bake_utilities::bakery_execute(next_command,dep_tree);
-
-          //Read our pipe
-          stdio_filebuf<char> child_in_(cmd_result.first,std::ios::in);
-          istream child_in(&child_in_);
-          bake_utilities::augment_depsystem(child_in,dep_tree);
-
-          //Ensure command completed normally by waiting on child.
-          siginfo_t child_status;
-          waitid(P_PID,cmd_result.second,&child_status,WEXITED);
-          if(child_status.si_code!=CLD_EXITED)
-          {
-               cerr << next_command << ": terminated by signal " << child_status.si_status << endl;
-               return 1;
-          }
-          else if(child_status.si_status!=0)
-          {
-               cerr << next_command  << ": exited with abnormal status " << child_status.si_status << endl;
-               return 1;
-          }
-     }
 
-     if(subdir=="")
-     {
-          //Start valid, then set to other status later if required.
-          for(const string& symname : dep_tree.get_symbols())
-               dep_tree.set_state(symname,DepSystem::VALID);
+          vector<string> generator_inputs;
+          run_bakefile(dep_tree,filename,false,generator_inputs);
 
-          //Go through and stat every target, setting dep_tree symbol statuses accordingly.
-          for(const string& symname : dep_tree.get_symbols())
-          {
-               struct stat statbuf;
-               int retval = stat(symname.c_str(),&statbuf);
-               if(retval!=0)
-               {
-                    dep_tree.set_state(symname,DepSystem::NONBUILT);
-                    dep_tree.invalidate_dependents(symname);
-                    continue;
-               }
-
-               //See if any of our dependencies was modified after us.
-               time_t sym_mtime = statbuf.st_mtime;
-               for(const string& depname : dep_tree.get_dependency_edges(symname))
-               {
-                    retval = stat(depname.c_str(),&statbuf);
-                    if(retval==0 && sym_mtime < statbuf.st_mtime)
-                    {
-                         dep_tree.set_state(symname,DepSystem::STALE);
-                         dep_tree.invalidate_dependents(symname);
-                         break;
-                    }
-               }
-          }
-
-          //Actually execute build plan
-          vector<string> symbols_remaining;
-          if(target!="")
-               symbols_remaining = dep_tree.get_build_plan(target);
-          else
-               symbols_remaining = dep_tree.get_symbols();
-
-          while(symbols_remaining.size())
-          {
-               DepSystem temp_deptree = dep_tree;
-               for(auto i = symbols_remaining.begin(); i!=symbols_remaining.end();)
-               {
-                    vector<string> build_plan = temp_deptree.get_build_plan(*i);
-                    if(build_plan.size()==1)
-                         dep_tree.build_symbol(*i);
-                    if(build_plan.size()==0)
-                         i = symbols_remaining.erase(i);
-                    else
-                         ++i;
-               }
-
-               while(bake_utilities::wait_queue.size())
-               {
-                    tuple<string,pid_t,time_t> build_result = bake_utilities::wait_queue.front();
-                    string& symname = std::get<0>(build_result);
-                    pid_t& child_pid = std::get<1>(build_result);
-                    time_t& before_build = std::get<2>(build_result);
-                    bake_utilities::wait_queue.pop();
-
-                    siginfo_t child_status;
-                    waitid(P_PID,child_pid,&child_status,WEXITED);
-                    if(child_status.si_code!=CLD_EXITED || child_status.si_status!=0)
-                         throw StringFunctions::permanent_c_str(symname+": build failure.");
-               
-                    //Okay, build exited normally.  Check if file modified.
-                    /*Note: If this behavior is found to sometimes be undesirable, perhaps a global option could disable it.
-                      Then again, if this behavior is found by someone to be undesirable, perhaps that person is doing it wrong.*/
-                    struct stat status;
-                    stat(symname.c_str(),&status);
-                    if(status.st_mtime < before_build)
-                         throw StringFunctions::permanent_c_str(symname+": build appeared to complete successfully but did not modify file.");
-               }
-          }
-     }
-     else //We were invoked with -sub, so output dep_tree to handler
-     {
+          //Output dep_tree to handler
           //TODO: need to parrot back anything from standard in unmodified, right?
-          
           auto output_mutator = [&subdir](string symname) noexcept
           {
                if(symname.find("../")==0)
@@ -220,11 +844,42 @@ try {
                     return subdir+"/"+symname;
           };
 
-          bakelib::output_depsystem(cout,dep_tree,output_mutator);
+          bakelib::output_depsystem(cout,dep_tree,output_mutator,bakelib::binary_interchange());
+          bake_trace::save();
+          bake_stats::report(cerr);
+          return 0;
      }
+
+     History history;
+     history.hash_mode = hash_mode;
+     history.log_path = BuildLog::path_for(filename);
+     history.hashes_path = HashCache::path_for(filename);
+     load_history(history);
+
+     if(watch_mode)
+          watch(filename,target,jobserver,history);
+     if(daemon_mode)
+          serve(filename,jobserver,history);
+
+     vector<string> generator_inputs;
+     run_bakefile(dep_tree,filename,true,generator_inputs);
+
+     vector<string> symbols = dep_tree.get_symbols();
+     FrozenDepSystem graph;
+     StatCache stat_cache;
+     vector<const StatCache::Status*> statuses;
+     unordered_set<string> out_of_date;
+     check_all(dep_tree,graph,symbols,stat_cache,statuses,history,out_of_date);
+
+     //Actually execute build plan
+     vector<Index> to_build;
+     unordered_set<string> built;
+     build(graph,target,out_of_date,jobserver,history,to_build,built);
 }
 catch(const char* e)
 {
+     bake_trace::save();
+     bake_stats::report(cerr);
      cerr << e << endl;
      return 1;
 }
@@ -0,0 +1,323 @@
+#include "bake_daemon.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::cout;
+using std::getenv;
+using std::memcpy;
+using std::strcpy;
+
+extern char** environ;
+
+//Requests bigger than this are garbage (or an attack), not a real command line and environment.
+static const uint32_t MAX_REQUEST_SIZE = 16*1024*1024;
+
+//Our own standard file descriptors and environment, while we're using a client's
+static int saved_fds[3];
+static vector<string> saved_environment;
+
+static vector<string> current_environment()
+{
+     vector<string> to_return;
+     for(char** variable = environ; *variable; variable++)
+          to_return.push_back(*variable);
+     return to_return;
+}
+
+static void set_environment(const vector<string>& environment)
+{
+     clearenv();
+     for(const string& variable : environment)
+     {
+          size_t equals = variable.find('=');
+          if(equals!=string::npos && equals!=0)
+               setenv(variable.substr(0,equals).c_str(),variable.c_str()+equals+1,1);
+     }
+}
+
+static bool write_all(int fd, const char* data, size_t size)
+{
+     while(size)
+     {
+          ssize_t written = send(fd,data,size,MSG_NOSIGNAL); //a client that went away mustn't kill us with SIGPIPE
+          if(written==-1)
+          {
+               if(errno==EINTR)
+                    continue;
+               return false;
+          }
+          data += written;
+          size -= written;
+     }
+     return true;
+}
+
+static bool read_all(int fd, char* data, size_t size)
+{
+     while(size)
+     {
+          ssize_t bytes_read = read(fd,data,size);
+          if(bytes_read==-1 && errno==EINTR)
+               continue;
+          if(bytes_read<=0)
+               return false;
+          data += bytes_read;
+          size -= bytes_read;
+     }
+     return true;
+}
+
+static void append_u32(string& message, uint32_t value)
+{
+     message.append(reinterpret_cast<const char*>(&value),sizeof(value));
+}
+
+//Appends a count and then that many NUL-terminated strings.
+static void append_strings(string& message, const vector<string>& strings)
+{
+     append_u32(message,strings.size());
+     for(const string& x : strings)
+          message.append(x.c_str(),x.size()+1);
+}
+
+//Reads what append_strings() wrote from message at position, advancing position.  Returns false if message ends first.
+static bool read_strings(const string& message, size_t& position, vector<string>& strings)
+{
+     uint32_t count;
+     if(position+sizeof(count) > message.size())
+          return false;
+     memcpy(&count,message.data()+position,sizeof(count));
+     position += sizeof(count);
+
+     for(uint32_t i=0; i<count; i++)
+     {
+          size_t end = message.find('\0',position);
+          if(end==string::npos)
+               return false;
+          strings.push_back(message.substr(position,end-position));
+          position = end+1;
+     }
+     return true;
+}
+
+//Fills in address for path.  Returns false if path is too long for a socket address.
+static bool make_address(sockaddr_un& address, const string& path)
+{
+     memset(&address,0,sizeof(address));
+     address.sun_family = AF_UNIX;
+     if(path.size() >= sizeof(address.sun_path))
+          return false;
+     strcpy(address.sun_path,path.c_str());
+     return true;
+}
+
+namespace bake_daemon
+{
+     string socket_path(const string& bakefile)
+     {
+          size_t slash = bakefile.rfind('/');
+          if(slash==string::npos)
+               return ".bake.sock";
+          return bakefile.substr(0,slash+1)+".bake.sock";
+     }
+
+     bool forward(const string& socket_path, int argc, char** argv, int& exit_status)
+     {
+          if(getenv("BAKE_NO_DAEMON"))
+               return false;
+
+          sockaddr_un address;
+          if(!make_address(address,socket_path))
+               return false;
+          int connection_fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+          if(connection_fd==-1)
+               return false;
+          if(connect(connection_fd,reinterpret_cast<sockaddr*>(&address),sizeof(address))==-1)
+          {
+               close(connection_fd);
+               return false;
+          }
+
+          char* working_directory = getcwd(NULL,0);
+          string message;
+          append_strings(message,vector<string>(argv+1,argv+argc));
+          append_strings(message,current_environment());
+          message.append(working_directory ? working_directory : "");
+          free(working_directory);
+
+          //Our standard file descriptors go along with the size of the request.
+          uint32_t size = message.size();
+          iovec size_vector = {&size,sizeof(size)};
+          char control[CMSG_SPACE(3*sizeof(int))];
+          memset(control,0,sizeof(control));
+          msghdr header;
+          memset(&header,0,sizeof(header));
+          header.msg_iov = &size_vector;
+          header.msg_iovlen = 1;
+          header.msg_control = control;
+          header.msg_controllen = sizeof(control);
+          cmsghdr* fds_message = CMSG_FIRSTHDR(&header);
+          fds_message->cmsg_level = SOL_SOCKET;
+          fds_message->cmsg_type = SCM_RIGHTS;
+          fds_message->cmsg_len = CMSG_LEN(3*sizeof(int));
+          int fds[3] = {0,1,2};
+          memcpy(CMSG_DATA(fds_message),fds,sizeof(fds));
+
+          //The reply is whether the daemon handled us, and, if so, our exit status.
+          int32_t reply[2];
+          bool handled = sendmsg(connection_fd,&header,MSG_NOSIGNAL)==sizeof(size) && write_all(connection_fd,message.data(),message.size())
+               && read_all(connection_fd,reinterpret_cast<char*>(reply),sizeof(reply)) && reply[0];
+          close(connection_fd);
+          if(handled)
+               exit_status = reply[1];
+          return handled;
+     }
+
+     int listen(const string& socket_path) throw(const char*)
+     {
+          sockaddr_un address;
+          if(!make_address(address,socket_path))
+               throw "Daemon socket path too long.";
+          int listen_fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+          if(listen_fd==-1)
+               throw "Could not create daemon socket.";
+
+          //Whoever can connect can have us run commands as ourselves, so the socket is made accessible to nobody else, however writable the tree is.
+          mode_t old_umask = umask(077);
+          if(bind(listen_fd,reinterpret_cast<sockaddr*>(&address),sizeof(address))==-1)
+          {
+               //If nobody answers on the socket that's there, it was left behind by a daemon which didn't shut down cleanly.
+               const char* error = "Could not bind daemon socket.";
+               if(errno==EADDRINUSE)
+               {
+                    int probe_fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+                    if(probe_fd!=-1 && connect(probe_fd,reinterpret_cast<sockaddr*>(&address),sizeof(address))==0)
+                         error = "A bake daemon is already running here.";
+                    else if(unlink(socket_path.c_str())==0 && bind(listen_fd,reinterpret_cast<sockaddr*>(&address),sizeof(address))==0)
+                         error = NULL;
+                    close(probe_fd);
+               }
+               if(error)
+               {
+                    umask(old_umask);
+                    close(listen_fd);
+                    throw error;
+               }
+          }
+          umask(old_umask);
+
+          if(::listen(listen_fd,SOMAXCONN)==-1)
+          {
+               close(listen_fd);
+               throw "Could not listen on daemon socket.";
+          }
+          return listen_fd;
+     }
+
+     bool receive(int listen_fd, Request& request)
+     {
+          request.connection_fd = accept4(listen_fd,NULL,NULL,SOCK_CLOEXEC);
+          if(request.connection_fd==-1)
+               return false;
+
+          //Only serve our own user, even if someone else managed to reach the socket.
+          ucred peer;
+          socklen_t peer_size = sizeof(peer);
+          if(getsockopt(request.connection_fd,SOL_SOCKET,SO_PEERCRED,&peer,&peer_size)==-1 || peer.uid!=geteuid())
+          {
+               close(request.connection_fd);
+               request.connection_fd = -1;
+               return false;
+          }
+          request.fds[0] = request.fds[1] = request.fds[2] = -1;
+
+          uint32_t size;
+          iovec size_vector = {&size,sizeof(size)};
+          char control[CMSG_SPACE(3*sizeof(int))];
+          msghdr header;
+          memset(&header,0,sizeof(header));
+          header.msg_iov = &size_vector;
+          header.msg_iovlen = 1;
+          header.msg_control = control;
+          header.msg_controllen = sizeof(control);
+          ssize_t received;
+          while((received = recvmsg(request.connection_fd,&header,MSG_CMSG_CLOEXEC))==-1 && errno==EINTR);
+          cmsghdr* fds_message = received>0 ? CMSG_FIRSTHDR(&header) : NULL;
+          if(fds_message && fds_message->cmsg_level==SOL_SOCKET && fds_message->cmsg_type==SCM_RIGHTS && fds_message->cmsg_len==CMSG_LEN(3*sizeof(int)))
+               memcpy(request.fds,CMSG_DATA(fds_message),sizeof(request.fds));
+
+          string message;
+          bool readable = received>0 && request.fds[0]!=-1
+               && read_all(request.connection_fd,reinterpret_cast<char*>(&size)+received,sizeof(size)-received) && size<=MAX_REQUEST_SIZE;
+          if(readable)
+          {
+               message.resize(size);
+               readable = read_all(request.connection_fd,&message[0],size);
+          }
+          size_t position = 0;
+          request.arguments.clear();
+          request.environment.clear();
+          if(!readable || !read_strings(message,position,request.arguments) || !read_strings(message,position,request.environment))
+          {
+               reply(request,false,0);
+               return false;
+          }
+          request.working_directory = message.substr(position);
+          return true;
+     }
+
+     void enter(const Request& request)
+     {
+          cout.flush();
+          for(int i=0; i<3; i++)
+          {
+               saved_fds[i] = fcntl(i,F_DUPFD_CLOEXEC,3);
+               dup2(request.fds[i],i);
+          }
+
+          const char* makeflags = getenv("MAKEFLAGS");
+          string our_makeflags = makeflags ? makeflags : "";
+          saved_environment = current_environment();
+          set_environment(request.environment);
+          if(makeflags)
+               setenv("MAKEFLAGS",our_makeflags.c_str(),1);
+          else
+               unsetenv("MAKEFLAGS");
+
+          //We're busy until the build is done, so a bake our build runs must not wait on us.
+          setenv("BAKE_NO_DAEMON","1",1);
+     }
+
+     void leave()
+     {
+          cout.flush();
+          for(int i=0; i<3; i++)
+          {
+               dup2(saved_fds[i],i);
+               close(saved_fds[i]);
+          }
+
+          set_environment(saved_environment);
+     }
+
+     void reply(Request& request, bool handled, int exit_status)
+     {
+          int32_t message[2] = {handled,exit_status};
+          write_all(request.connection_fd,reinterpret_cast<const char*>(message),sizeof(message));
+          close(request.connection_fd);
+          for(int& fd : request.fds)
+               if(fd!=-1)
+               {
+                    close(fd);
+                    fd = -1;
+               }
+     }
+}
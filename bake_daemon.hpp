@@ -0,0 +1,44 @@
+#ifndef BAKE_DAEMON_HPP
+#define BAKE_DAEMON_HPP
+
+#include "deplib.hpp"
+
+/*A bake daemon keeps a source tree's graph in memory and builds it for bake clients, which connect to it over a Unix domain socket
+  next to the Bakefile.  A client sends its arguments, working directory, and environment, along with its standard input, output, and error,
+  which the daemon's builds then use as their own; when the build is done, the daemon sends back the client's exit status.*/
+namespace bake_daemon
+{
+     //Returns the path of the socket belonging to the passed Bakefile.
+     string socket_path(const string& bakefile);
+
+     /*Client side: has the daemon listening on socket_path, if any, run us.
+       Returns false if there is no daemon, the daemon can't do what we were asked, or BAKE_NO_DAEMON is set; otherwise, returns true and sets exit_status.*/
+     bool forward(const string& socket_path, int argc, char** argv, int& exit_status);
+
+     //What a client asked of us
+     struct Request
+     {
+          vector<string> arguments; //without argv[0]
+          string working_directory;
+          vector<string> environment;
+          int fds[3]; //the client's standard input, output, and error
+          int connection_fd;
+     };
+
+     /*Server side: starts listening on socket_path, replacing any socket left behind by a daemon which is no longer running.  Only our user may connect to the socket.
+       Throws exception if a daemon is running there, or on error.*/
+     int listen(const string& socket_path) throw(const char*);
+
+     //Accepts a connection on listen_fd and reads the client's request.  Returns false if the client went away, isn't running as our user, or sent something unreadable.
+     bool receive(int listen_fd, Request& request);
+
+     /*Makes our standard file descriptors and environment those of the client which sent request, until leave() is called.
+       Our MAKEFLAGS are kept, so that build commands still share our jobserver, and BAKE_NO_DAEMON is set, so that bakes they run don't wait on us.*/
+     void enter(const Request& request);
+     void leave();
+
+     //Tells the client its exit status, or, if handled is false, that it must build for itself.  Closes everything request holds.
+     void reply(Request& request, bool handled, int exit_status);
+}
+
+#endif
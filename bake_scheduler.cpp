@@ -0,0 +1,258 @@
+#include "bake_scheduler.hpp"
+#include "bake_stats.hpp"
+#include "bake_trace.hpp"
+#include "hash_cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using bake_utilities::restat_symbols;
+using bake_utilities::wait_queue;
+using std::make_pair;
+using std::make_tuple;
+using std::max;
+using std::priority_queue;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+typedef FrozenDepSystem::Index Index;
+
+namespace bake_scheduler
+{
+     void build(FrozenDepSystem& graph, const vector<Index>& to_build, const unordered_set<string>& out_of_date, Jobserver& jobserver, BuildLog& build_log, function<void(string)> built_callback) throw(const char*)
+     {
+          Index symbol_count = graph.get_symbol_count();
+
+          //Which symbols we have to build, and for each, the number of its dependencies we have yet to build and the number of symbols waiting on it
+          vector<bool> planned(symbol_count,false);
+          vector<int> unbuilt_deps(symbol_count,0), waiting_count(symbol_count,0);
+          for(Index symbol : to_build)
+               planned[symbol] = true;
+          for(Index symbol : to_build)
+               for(auto deps = graph.get_direct_dependencies(symbol); deps.first!=deps.second; ++deps.first)
+                    if(planned[*deps.first])
+                    {
+                         unbuilt_deps[symbol]++;
+                         waiting_count[*deps.first]++;
+                    }
+
+          /*Length of the longest chain of builds from each symbol to the end of the build, ourselves included.
+            Since to_build is in buildable order, walking it backwards visits every symbol after everything waiting on it.*/
+          vector<long> critical_path(symbol_count,0);
+          long default_duration = build_log.mean_duration();
+          for(auto i = to_build.rbegin(); i!=to_build.rend(); ++i)
+          {
+               const BuildLog::Entry* history = build_log.find(graph.get_name(*i));
+               long longest_wait = 0;
+               for(auto dependents = graph.get_direct_dependents(*i); dependents.first!=dependents.second; ++dependents.first)
+                    if(planned[*dependents.first])
+                         longest_wait = max(longest_wait,critical_path[*dependents.first]);
+               critical_path[*i] = (history && history->duration_ms>=0 ? history->duration_ms : default_duration) + longest_wait;
+          }
+
+          //Symbols ready to be built, most critical first
+          priority_queue<tuple<long,int,Index>> ready;
+          auto make_ready = [&](Index symbol)
+          {
+               ready.push(make_tuple(critical_path[symbol],waiting_count[symbol],symbol));
+          };
+          for(Index symbol : to_build)
+               if(unbuilt_deps[symbol]==0)
+                    make_ready(symbol);
+
+          //The symbols in out_of_date, which are stale on their own account
+          vector<bool> stale(symbol_count,false);
+          for(const string& symname : out_of_date)
+          {
+               Index symbol = graph.find_symbol(symname);
+               if(symbol!=FrozenDepSystem::NOT_FOUND)
+                    stale[symbol] = true;
+          }
+
+          /*Symbols with a dependency whose build changed it, and symbols with a dependency rewritten with the same contents (or skipped because of one).
+            Symbols in neither which aren't out_of_date themselves are skipped.*/
+          vector<bool> changed_dependencies(symbol_count,false), rewritten_dependencies(symbol_count,false);
+
+          //Called when a symbol has been built or skipped: anything waiting only on it becomes ready.
+          auto finish = [&](Index symbol, bool changed, bool rewritten)
+          {
+               built_callback(graph.get_name(symbol));
+               for(auto dependents = graph.get_direct_dependents(symbol); dependents.first!=dependents.second; ++dependents.first)
+               {
+                    Index dependent = *dependents.first;
+                    if(!planned[dependent])
+                         continue;
+                    if(changed)
+                         changed_dependencies[dependent] = true;
+                    else if(rewritten)
+                         rewritten_dependencies[dependent] = true;
+                    if(--unbuilt_deps[dependent]==0)
+                         make_ready(dependent);
+               }
+          };
+
+          //Status and contents of each running restat symbol from before its build, if it existed, and the modification time of the newest of its dependencies then
+          unordered_map<Index,tuple<struct stat,uint64_t,timespec>> restat_before;
+
+          //Running jobs by pid: symbol, build start for the did-it-modify-the-file check, start for timing, and job slot (counting from 1)
+          unordered_map<pid_t,tuple<Index,time_t,steady_clock::time_point,int>> running;
+          vector<bool> slot_used;
+          auto take_slot = [&]()
+          {
+               size_t slot = 0;
+               while(slot < slot_used.size() && slot_used[slot])
+                    slot++;
+               if(slot==slot_used.size())
+                    slot_used.push_back(true);
+               slot_used[slot] = true;
+               return int(slot+1);
+          };
+
+          //Our first job runs in our implicit slot; every other running job holds a jobserver token.
+          auto return_spare_tokens = [&]()
+          {
+               while(jobserver.tokens_held() > (running.size() ? running.size()-1 : 0))
+                    jobserver.release();
+          };
+
+          const char* failure = NULL;
+          while(true)
+          {
+               //Fill every free job slot with a ready symbol.
+               while(!failure && ready.size() && (!running.size() || jobserver.acquire()))
+               {
+                    Index symbol = std::get<2>(ready.top());
+                    const char* symname = graph.get_name(symbol);
+                    ready.pop();
+
+                    if(!stale[symbol] && !changed_dependencies[symbol])
+                    {
+                         /*Nothing we depend on changed, so we're still up to date.
+                           If something was rewritten, though, we have to become newer than it, or we'll look stale next time.*/
+                         bool rewritten = rewritten_dependencies[symbol];
+                         if(rewritten)
+                              utimensat(AT_FDCWD,symname,NULL,0);
+                         graph.set_state(symbol,DepSystem::VALID);
+                         finish(symbol,false,rewritten);
+                         return_spare_tokens();
+                         continue;
+                    }
+
+                    struct stat before;
+                    BAKE_COUNT(STAT_CALLS,restat_symbols.count(symname));
+                    if(restat_symbols.count(symname) && stat(symname,&before)==0)
+                    {
+                         //Should the build leave us untouched, we're up to date with our dependencies as they are now.
+                         timespec newest_dependency = {0,0};
+                         for(auto edges = graph.get_dependency_edges(symbol); edges.first!=edges.second; ++edges.first)
+                         {
+                              struct stat dep_status;
+                              BAKE_COUNT(STAT_CALLS,1);
+                              if(stat(graph.get_name(*edges.first),&dep_status)==0 && (dep_status.st_mtim.tv_sec > newest_dependency.tv_sec ||
+                                   (dep_status.st_mtim.tv_sec==newest_dependency.tv_sec && dep_status.st_mtim.tv_nsec > newest_dependency.tv_nsec)))
+                                   newest_dependency = dep_status.st_mtim;
+                         }
+                         restat_before[symbol] = make_tuple(before,HashCache::hash_file(symname),newest_dependency);
+                    }
+
+                    try
+                    {
+                         graph.build_single_symbol(symbol);
+                    }
+                    catch(const char* e)
+                    {
+                         failure = e;
+                         return_spare_tokens();
+                         break;
+                    }
+
+                    //A symbol without a callback is built as soon as it is "started".
+                    if(!wait_queue.size())
+                         finish(symbol,true,false);
+                    for(; wait_queue.size(); wait_queue.pop())
+                         running.emplace(std::get<1>(wait_queue.front()),make_tuple(symbol,std::get<2>(wait_queue.front()),steady_clock::now(),take_slot()));
+                    return_spare_tokens();
+               }
+
+               if(!running.size())
+                    break;
+
+               //Reap whichever child exits first, no matter when it was started.
+               int child_status;
+               pid_t child_pid = waitpid(-1,&child_status,0);
+               if(child_pid==-1)
+               {
+                    if(errno==EINTR)
+                         continue;
+                    throw "waitpid() failed while waiting on build jobs.";
+               }
+
+               auto job = running.find(child_pid);
+               if(job==running.end())
+                    continue;
+               Index symbol = std::get<0>(job->second);
+               string symname = graph.get_name(symbol);
+               time_t before_build = std::get<1>(job->second);
+               steady_clock::time_point started = std::get<2>(job->second);
+               int slot = std::get<3>(job->second);
+               running.erase(job);
+               slot_used[slot-1] = false;
+               return_spare_tokens();
+               bake_trace::record(symname,"job",started,steady_clock::now(),slot,{{"pid",child_pid},{"slot",slot},{"status",child_status}});
+
+               if(!WIFEXITED(child_status) || WEXITSTATUS(child_status)!=0)
+               {
+                    if(!failure)
+                         failure = StringFunctions::permanent_c_str(symname+": build failure.");
+                    continue;
+               }
+
+               /*Okay, build exited normally.  See if a restat symbol came out the same as it went in.
+                 Left alone, it's unchanged, and stays older than its dependencies, so the log remembers it's up to date with them;
+                 rewritten with the same contents, it's unchanged but newer.*/
+               struct stat status;
+               BAKE_COUNT(STAT_CALLS,1);
+               bool exists = stat(symname.c_str(),&status)==0;
+               bool changed = true, rewritten = false;
+               auto before = restat_before.find(symbol);
+               if(before!=restat_before.end())
+               {
+                    const struct stat& old_status = std::get<0>(before->second);
+                    if(exists && status.st_size==old_status.st_size)
+                    {
+                         if(status.st_ino==old_status.st_ino && status.st_mtim.tv_sec==old_status.st_mtim.tv_sec && status.st_mtim.tv_nsec==old_status.st_mtim.tv_nsec)
+                         {
+                              changed = false;
+                              build_log.set_checked_mtime(symname,std::get<2>(before->second));
+                         }
+                         else if(std::get<1>(before->second) && HashCache::hash_file(symname)==std::get<1>(before->second))
+                              changed = false, rewritten = true;
+                    }
+                    restat_before.erase(before);
+               }
+
+               //Otherwise, check if file modified.
+               /*Note: If this behavior is found to sometimes be undesirable, perhaps a global option could disable it.
+                 Then again, if this behavior is found by someone to be undesirable, perhaps that person is doing it wrong.
+                 (It was found to be, and that's what restat is for.)*/
+               if(changed && (!exists || status.st_mtime < before_build))
+               {
+                    if(!failure)
+                         failure = StringFunctions::permanent_c_str(symname+": build appeared to complete successfully but did not modify file.");
+                    continue;
+               }
+
+               build_log.set_duration(symname,duration_cast<milliseconds>(steady_clock::now()-started).count());
+               finish(symbol,changed,rewritten);
+          }
+
+          if(failure)
+               throw failure;
+     }
+}
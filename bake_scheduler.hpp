@@ -0,0 +1,26 @@
+#ifndef BAKE_SCHEDULER_HPP
+#define BAKE_SCHEDULER_HPP
+
+#include "bake_utilities.hpp"
+#include "build_log.hpp"
+#include "frozen_depsystem.hpp"
+#include "jobserver.hpp"
+
+namespace bake_scheduler
+{
+     /*Builds the passed symbols of graph, which must all be stale or nonbuilt and be given in increasing order, running as many build commands at once as jobserver gives us slots for.
+       Keeps a count of unbuilt dependencies for every symbol, reaps each child as soon as it exits,
+       and starts the symbols that child unblocked right away rather than waiting for the rest of its "wave".
+       Of the symbols that are ready, the one heading the longest remaining chain of builds goes first.
+       Chain lengths come from the durations in build_log; symbols without history count as an average build,
+       and ties (such as when there is no history at all) go to the symbol with more dependents waiting on it.
+       out_of_date holds the symbols which are stale on their own account; the rest of to_build are there only because something they depend on is.
+       When a restat symbol's build leaves it unmodified or rewrites it with the same contents, symbols of the latter kind left with no changed dependencies are skipped.
+       The duration of every successful build is recorded in build_log, and built_callback is called with the name of every symbol built or skipped.
+       If a build fails, no new jobs are started, the running ones are waited on, and then the failure is thrown.
+       Our bookkeeping is in arrays indexed like graph, and states are set in graph.*/
+     void build(FrozenDepSystem& graph, const vector<FrozenDepSystem::Index>& to_build, const unordered_set<string>& out_of_date, Jobserver& jobserver, BuildLog& build_log,
+                function<void(string)> built_callback = [](string symname) noexcept {}) throw(const char*);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "bake_stats.hpp"
+#include <iomanip>
+#include <sys/resource.h>
+#include <vector>
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::endl;
+using std::left;
+using std::setw;
+using std::string;
+using std::vector;
+
+static const char* const COUNTER_NAMES[bake_stats::COUNTER_COUNT] =
+{
+     "stat calls",
+     "processes spawned",
+     "bytes piped to children",
+     "bytes piped from children",
+     "symbol lookups",
+     "symbol copies",
+     "cycle checks",
+     "cycle check nodes visited",
+     "dependency closures",
+};
+
+struct PhaseRecord
+{
+     const char* name;
+     long long elapsed_us;
+     long peak_rss_kb;
+};
+static vector<PhaseRecord> phases;
+
+namespace bake_stats
+{
+     uint64_t counters[COUNTER_COUNT];
+     bool enabled = false;
+
+     Phase::~Phase()
+     {
+          if(!enabled)
+               return;
+          rusage usage;
+          getrusage(RUSAGE_SELF,&usage);
+          phases.push_back(PhaseRecord{name,duration_cast<microseconds>(steady_clock::now()-begin).count(),usage.ru_maxrss});
+     }
+
+     void report(std::ostream& out)
+     {
+          //Nothing happened since we last reported.
+          if(!enabled || !phases.size())
+               return;
+
+          out << "bake: stats\n";
+#ifndef BAKE_NO_STATS
+          for(int i=0; i<COUNTER_COUNT; i++)
+               out << "  " << left << setw(28) << COUNTER_NAMES[i] << counters[i] << '\n';
+#endif
+          for(const PhaseRecord& phase : phases)
+               out << "  " << left << setw(28) << (string(phase.name)+" phase") << phase.elapsed_us/1000.0 << " ms, peak RSS " << phase.peak_rss_kb << " KiB\n";
+          out.flush();
+
+          for(uint64_t& counter : counters)
+               counter = 0;
+          phases.clear();
+     }
+}
@@ -0,0 +1,69 @@
+#ifndef BAKE_STATS_HPP
+#define BAKE_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/*Counters of the operations whose numbers tell us whether bake and deplib do as much work as they should, and how long each phase of a run took,
+  reported by --stats.  Counting is a plain increment, whether or not --stats was given; building with -DBAKE_NO_STATS compiles it out entirely.
+  Counters are only touched from bake's main thread.*/
+namespace bake_stats
+{
+     enum Counter
+     {
+          STAT_CALLS,
+          PROCESSES_SPAWNED,
+          BYTES_TO_CHILDREN,
+          BYTES_FROM_CHILDREN,
+          SYMBOL_LOOKUPS, //DepSystem lookups of symbols by name
+          SYMBOL_COPIES,
+          CYCLE_CHECKS, //searches for cycles: each edge added out of build order (DepSystem::order_dependency()), and each rebuild of the whole order (update_build_order(), as by commit_batch())
+          CYCLE_CHECK_NODES, //symbols visited by those searches
+          DEPENDENCY_CLOSURES, //calls to get_dependencies_recursive()
+          COUNTER_COUNT
+     };
+
+     extern uint64_t counters[COUNTER_COUNT];
+
+     //Whether we report anything; set by --stats.
+     extern bool enabled;
+
+     //Remembers how long the phase named name took and the peak RSS at its end, when enabled.
+     class Phase
+     {
+     public:
+          Phase(const char* name_) : name(name_), begin(std::chrono::steady_clock::now()) {}
+          ~Phase();
+
+     private:
+          const char* name;
+          std::chrono::steady_clock::time_point begin;
+     };
+
+     //If enabled, writes the counters and phases to out, then starts counting afresh.  Does nothing if no phase ended since the last report.
+     void report(std::ostream& out);
+
+#ifndef BAKE_NO_STATS
+     //A member which counts copies of the object containing it in counter
+     template<Counter counter> struct CopyCounter
+     {
+          CopyCounter() noexcept {}
+          CopyCounter(const CopyCounter&) noexcept { counters[counter]++; }
+          CopyCounter(CopyCounter&&) noexcept {}
+          CopyCounter& operator=(const CopyCounter&) noexcept { counters[counter]++; return *this; }
+          CopyCounter& operator=(CopyCounter&&) noexcept { return *this; }
+     };
+#endif
+}
+
+#ifdef BAKE_NO_STATS
+#define BAKE_COUNT(counter,n) ((void)0)
+#define BAKE_COUNT_COPIES(counter)
+#else
+#define BAKE_COUNT(counter,n) (bake_stats::counters[bake_stats::counter] += (n))
+#define BAKE_COUNT_COPIES(counter) bake_stats::CopyCounter<bake_stats::counter> counter##_counter;
+#endif
+
+#endif
@@ -0,0 +1,116 @@
+#include "bake_trace.hpp"
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <unistd.h>
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::ofstream;
+using std::rename;
+using std::set;
+using std::snprintf;
+
+static bool recording = false;
+static string trace_path;
+static bake_trace::Time trace_start;
+
+struct Event
+{
+     string name;
+     const char* category;
+     long long begin_us;
+     long long duration_us;
+     int row;
+     vector<pair<string,long long>> args;
+};
+static vector<Event> events;
+static set<int> rows{0};
+
+//Returns x as a JSON string literal.
+static string quote(const string& x)
+{
+     string to_return = "\"";
+     for(unsigned char c : x)
+          switch(c)
+          {
+          case '"': to_return += "\\\""; break;
+          case '\\': to_return += "\\\\"; break;
+          case '\n': to_return += "\\n"; break;
+          case '\t': to_return += "\\t"; break;
+          default:
+               if(c < 0x20)
+               {
+                    char escape[7];
+                    snprintf(escape,sizeof(escape),"\\u%04x",c);
+                    to_return += escape;
+               }
+               else
+                    to_return += c;
+          }
+     return to_return+"\"";
+}
+
+namespace bake_trace
+{
+     void start(const string& path)
+     {
+          recording = true;
+          trace_path = path;
+          trace_start = steady_clock::now();
+     }
+
+     bool enabled()
+     {
+          return recording;
+     }
+
+     void record(const string& name, const char* category, Time begin, Time end, int row, const vector<pair<string,long long>>& args)
+     {
+          if(!recording)
+               return;
+          events.push_back(Event{name,category,duration_cast<microseconds>(begin-trace_start).count(),duration_cast<microseconds>(end-begin).count(),row,args});
+          rows.insert(row);
+     }
+
+     string command_name(const string& command)
+     {
+          return command.substr(0,command.find('\n'));
+     }
+
+     bool save()
+     {
+          if(!recording)
+               return true;
+
+          string temp_path = trace_path+".tmp";
+          ofstream fout(temp_path);
+          pid_t pid = getpid();
+          fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+          //Name the rows, so the viewer shows bake, its job slots, and its generators rather than thread numbers.
+          fout << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"bake\"}}";
+          for(int row : rows)
+          {
+               string row_name = row>=GENERATOR_ROWS ? "generator "+to_string(row-GENERATOR_ROWS) : row ? "slot "+to_string(row) : "bake";
+               fout << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << row
+                    << ",\"args\":{\"name\":" << quote(row_name) << "}}";
+          }
+
+          for(const Event& event : events)
+          {
+               fout << ",\n{\"name\":" << quote(event.name) << ",\"cat\":" << quote(event.category) << ",\"ph\":\"X\",\"ts\":" << event.begin_us
+                    << ",\"dur\":" << event.duration_us << ",\"pid\":" << pid << ",\"tid\":" << event.row << ",\"args\":{";
+               for(size_t i=0; i<event.args.size(); i++)
+                    fout << (i ? "," : "") << quote(event.args[i].first) << ':' << event.args[i].second;
+               fout << "}}";
+          }
+          fout << "\n]}\n";
+          fout.close();
+
+          if(!fout.good())
+               return false;
+          return rename(temp_path.c_str(),trace_path.c_str())==0;
+     }
+}
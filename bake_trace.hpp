@@ -0,0 +1,49 @@
+#ifndef BAKE_TRACE_HPP
+#define BAKE_TRACE_HPP
+
+#include "deplib.hpp"
+#include <chrono>
+#include <utility>
+
+using std::pair;
+
+/*Timeline of what bake did, written by --trace in the Chrome trace event format, for viewing in Perfetto or chrome://tracing.
+  Each event is a span on a row: row 0 is bake itself, row N is build job slot N, and row GENERATOR_ROWS+N is the Nth command of the Bakefile,
+  since they run alongside each other, but not in job slots.
+  Everything is recorded from bake's main thread.*/
+namespace bake_trace
+{
+     typedef std::chrono::steady_clock::time_point Time;
+
+     static const int GENERATOR_ROWS = 1000000;
+
+     //Starts recording; save() will write what we recorded to path.
+     void start(const string& path);
+
+     //Returns whether we're recording.
+     bool enabled();
+
+     //Records a span named name, of category category, from begin to end on row row, with the passed arguments.  Does nothing unless we're recording.
+     void record(const string& name, const char* category, Time begin, Time end, int row = 0, const vector<pair<string,long long>>& args = {});
+
+     //Returns the name to give the span of a Bakefile command: its first line, without the newline.
+     string command_name(const string& command);
+
+     //Writes everything recorded so far to our trace file, replacing it.  Returns whether the file could be written.
+     bool save();
+
+     //Records a span on row 0 from its construction to its destruction.
+     class Span
+     {
+     public:
+          Span(const string& name_, const char* category_) : name(name_), category(category_), begin(std::chrono::steady_clock::now()) {}
+          ~Span() { record(name,category,begin,std::chrono::steady_clock::now()); }
+
+     private:
+          string name;
+          const char* category;
+          Time begin;
+     };
+}
+
+#endif
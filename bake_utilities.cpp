@@ -1,18 +1,44 @@
 #include "bake_utilities.hpp"
+#include "bake_stats.hpp"
+#include "bake_trace.hpp"
+#include "depsnapshot.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <ctime>
-#include <ext/stdio_filebuf.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <queue>
+#include <spawn.h>
+#include <sstream>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+using std::ostringstream;
 using std::queue;
-using __gnu_cxx::stdio_filebuf;
+using std::set;
+using std::memchr;
+using std::memcmp;
+using std::strchr;
+using std::strlen;
+using std::strncmp;
+using std::strerror;
 using std::time;
 
+extern char** environ;
+
+//What we ask for as the size of the pipes to and from Bakefile commands
+static const int PIPE_SIZE = 1024*1024;
+
+//The types of binary interchange records, in the order of Record::Type
+static const char RECORD_TYPES[] = "SDA";
+
 namespace bake_utilities
 {
+     const string BINARY_INTERCHANGE_MAGIC("\0BAKEBIF",8);
+
      static void scan_line(vector<string>& tokens, queue<string>& sentinels, const string& line) throw(const char*)
      {
           bool backslash_escape = false;
@@ -118,6 +144,7 @@ namespace bake_utilities
      //Function for use as DepSystem callback.
      //Executes string value symval as command using exec, waits on it, and throws an exception if the command exited with error.  Also uses stat() to check that the file symname has been built successfully (and that the modification time has changed to near the present).
      queue<tuple<string,pid_t,time_t>> wait_queue;
+     unordered_set<string> restat_symbols;
      static void dep_callback(string symname, string symval)
      {
           //Throw exception immediately if symval is the empty string
@@ -125,18 +152,247 @@ namespace bake_utilities
                throw StringFunctions::permanent_c_str(symname+": No rule to build target.");
 
           time_t before_build = time(NULL);
-          pair<int,pid_t> build_result = bakery_execute(symval);
-          wait_queue.push(make_tuple(symname,build_result.second,before_build));
-          close(build_result.first); //we'll never need this
+          wait_queue.push(make_tuple(symname,bakery_spawn(symval),before_build));
+     }
+
+     //A stretch of the buffer being parsed, which it doesn't own
+     struct Piece
+     {
+          const char* data;
+          size_t size;
+
+          string str() const { return string(data,size); }
+          bool operator==(const string& x) const { return x.size()==size && memcmp(x.data(),data,size)==0; }
+     };
+
+     //Returns the end of the line starting at begin: its newline, or end if it hasn't one.
+     static const char* line_end(const char* begin, const char* end)
+     {
+          const void* newline = memchr(begin,'\n',end-begin);
+          return newline ? static_cast<const char*>(newline) : end;
+     }
+
+     /*Returns the end of the record starting at begin, just past its final newline: a line, and, if it opens sentinels, every line through the last sentinel.
+       Throws exception as get_command() does.*/
+     static const char* record_end(const char* begin, const char* end) throw(const char*)
+     {
+          const char* first_end = line_end(begin,end);
+          const char* next = first_end==end ? end : first_end+1;
+
+          //Only a line with a backslash or less-than can open a sentinel or be malformed, so only those need scanning.
+          if(!memchr(begin,'\\',first_end-begin) && !memchr(begin,'<',first_end-begin))
+               return next;
+          queue<string> sentinels;
+          vector<string> discard;
+          scan_line(discard,sentinels,string(begin,first_end));
+          while(sentinels.size())
+          {
+               if(next==end)
+                    throw "EOF reached while reading sentinel.";
+               const char* this_end = line_end(next,end);
+               if(Piece{next,size_t(this_end-next)}==sentinels.front())
+                    sentinels.pop();
+               next = this_end==end ? end : this_end+1;
+          }
+          return next;
+     }
+
+     /*Finds the first whitespace-separated tokens of [begin,end), putting up to max_tokens of them in tokens.
+       Returns how many there are, or max_tokens+1 if there are more than that.*/
+     static size_t split_tokens(const char* begin, const char* end, Piece* tokens, size_t max_tokens)
+     {
+          size_t count = 0;
+          const char* x = begin;
+          while(true)
+          {
+               while(x!=end && (*x==' ' || *x=='\t' || *x=='\n'))
+                    x++;
+               if(x==end)
+                    return count;
+               if(count==max_tokens)
+                    return count+1;
+               const char* token_begin = x;
+               while(x!=end && *x!=' ' && *x!='\t' && *x!='\n')
+                    x++;
+               tokens[count++] = Piece{token_begin,size_t(x-token_begin)};
+          }
+     }
+
+     //One record of the Baker Interchange Format, as it lies in the buffer being parsed
+     struct Record
+     {
+          enum Type { DEFINITION, DEPENDENCY, ATTRIBUTE } type;
+          Piece first; //the symbol, or, for a dependency, what's depended on
+          Piece second; //its value, the dependent, or the attribute
+          bool text; //read from text, where a value is the rest of its record and ends with a newline, even where the stream doesn't
+     };
+
+     //Returns the value record defines.
+     static string record_value(const Record& record)
+     {
+          string value = record.second.str();
+          if(record.text && (!value.size() || value.back()!='\n'))
+               value += '\n';
+          return value;
+     }
+
+     //Calls visit with each record of the text in [begin,end).
+     template<typename Visitor> static void parse_text(const char* begin, const char* end, Visitor visit) throw(const char*)
+     {
+          //Note: this code doesn't yet handle really bad filenames which need sentinels to represent; the binary framing does.
+          const char* next;
+          for(const char* record = begin; record!=end; record = next)
+          {
+               next = record_end(record,end);
+
+               //Only the first three tokens matter; blank lines are skipped.
+               Piece tokens[3];
+               size_t token_count = split_tokens(record,next,tokens,3);
+               if(!token_count)
+                    continue;
+               if(token_count>1 && tokens[1]=="!")
+               {
+                    if(token_count!=3)
+                         throw "Invalid attribute specification.";
+                    visit(Record{Record::ATTRIBUTE,tokens[0],tokens[2],true});
+               }
+               else if(token_count==1 || !(tokens[1]=="/"))
+               {
+                    //The value is everything after the name and the character following it, as get_command() returns it; the record may be indented.
+                    const char* value = tokens[0].data+tokens[0].size+(token_count==1 ? 0 : 1);
+                    visit(Record{Record::DEFINITION,tokens[0],Piece{value,size_t(next-value)},true});
+               }
+               else
+               {
+                    if(token_count!=3)
+                         throw "Invalid dependency specification.";
+                    visit(Record{Record::DEPENDENCY,tokens[0],tokens[2],true});
+               }
+          }
+     }
+
+     //Returns the next field of a binary record at x, moving x past it.
+     static Piece read_field(const char*& x, const char* end) throw(const char*)
+     {
+          if(end-x<4)
+               throw "Truncated binary interchange record.";
+          const unsigned char* length_bytes = reinterpret_cast<const unsigned char*>(x);
+          size_t length = length_bytes[0] | length_bytes[1]<<8 | length_bytes[2]<<16 | size_t(length_bytes[3])<<24;
+          x += 4;
+          if(size_t(end-x)<length)
+               throw "Truncated binary interchange record.";
+          Piece field{x,length};
+          x += length;
+          return field;
+     }
+
+     //Calls visit with each record of the binary framing in [begin,end), which starts with BINARY_INTERCHANGE_MAGIC.
+     template<typename Visitor> static void parse_binary(const char* begin, const char* end, Visitor visit) throw(const char*)
+     {
+          const char* x = begin;
+          while(x!=end)
+          {
+               //Concatenated streams repeat the preamble.
+               if(*x=='\0')
+               {
+                    if(size_t(end-x)<BINARY_INTERCHANGE_MAGIC.size() || memcmp(x,BINARY_INTERCHANGE_MAGIC.data(),BINARY_INTERCHANGE_MAGIC.size()))
+                         throw "Invalid binary interchange preamble.";
+                    x += BINARY_INTERCHANGE_MAGIC.size();
+                    continue;
+               }
+
+               const char* type = strchr(RECORD_TYPES,*x);
+               if(!type)
+                    throw "Invalid binary interchange record.";
+               x++;
+               Piece first = read_field(x,end);
+               Piece second = read_field(x,end);
+               visit(Record{Record::Type(type-RECORD_TYPES),first,second,false});
+          }
+     }
+
+     //Calls visit with each record of the size bytes at data, in either framing.
+     template<typename Visitor> static void parse_interchange(const char* data, size_t size, Visitor visit) throw(const char*)
+     {
+          if(size && data[0]=='\0')
+               parse_binary(data,data+size,visit);
+          else
+               parse_text(data,data+size,visit);
+     }
+
+     //Writes each warning from write_record() to standard error.
+     static void warn_left_out(const set<string>& left_out)
+     {
+          for(const string& warning : left_out)
+               std::cerr << "bake: warning: " << warning << endl;
      }
 
-     void augment_depsystem(istream& din, DepSystem& to_construct, function<string(string)> mutator) throw(const char*)
+     /*Writes the record of type made of first and second to dout, in binary if binary is set.
+       If text can't represent it, leaves it out, adding a warning saying so to left_out.*/
+     static void write_record(ostream& dout, Record::Type type, const string& first, const string& second, bool binary, set<string>& left_out)
      {
-          auto add_if_not_present = [&to_construct](string symname, string symval)
+          if(binary)
+          {
+               dout << RECORD_TYPES[type];
+               for(const string* field : {&first,&second})
+               {
+                    uint32_t length = field->size();
+                    char length_bytes[4] = {char(length),char(length>>8),char(length>>16),char(length>>24)};
+                    dout.write(length_bytes,4);
+                    dout << *field;
+               }
+               return;
+          }
+
+          for(const string* name : {&first,&second})
+               if(name==&first || type==Record::DEPENDENCY)
+                    if(!name->size() || name->find_first_of(" \t\n")!=string::npos)
+                    {
+                         left_out.insert("\""+*name+"\": symbol name can't be written as text, so commands reading text aren't told about it.");
+                         return;
+                    }
+          switch(type)
+          {
+          case Record::DEFINITION:
+          {
+               string line = first+' '+second;
+               if(!second.size() || second.back()!='\n')
+                    line += '\n';
+
+               //A value of several lines has to be one record: a command whose sentinels end where it does.
+               if(second.find('\n')<second.size()-1 && record_end(line.data(),line.data()+line.size())!=line.data()+line.size())
+               {
+                    left_out.insert(first+": command can't be written as text, so commands reading text aren't told about it.");
+                    return;
+               }
+               dout << line;
+               break;
+          }
+          case Record::DEPENDENCY:
+               dout << first << " / " << second << '\n';
+               break;
+          case Record::ATTRIBUTE:
+               dout << first << " ! " << second << '\n';
+               break;
+          }
+     }
+
+     void augment_depsystem(istream& din, DepSystem& to_construct, function<string(string)> mutator, function<void(const string&,const string&)> defined) throw(const char*)
+     {
+          string data;
+          char buffer[65536];
+          while(din.read(buffer,sizeof(buffer)) || din.gcount())
+               data.append(buffer,din.gcount());
+          augment_depsystem(data.data(),data.size(),to_construct,mutator,defined);
+     }
+
+     void augment_depsystem(const char* data, size_t size, DepSystem& to_construct, function<string(string)> mutator, function<void(const string&,const string&)> defined) throw(const char*)
+     {
+          auto add_if_not_present = [&to_construct](const string& symname, const string& symval)
           {
                if(!to_construct.has_symbol(symname))
                {
-                    if(symname.substr(0,3)=="../")
+                    if(symname.compare(0,3,"../")==0)
                          throw "Attempted to add symbol outside working directory.";
 
                     to_construct.add_set_symbol(symname,symval);
@@ -144,57 +400,96 @@ namespace bake_utilities
                }
           };
 
-          //Note: this code doesn't yet handle really bad filenames which need sentinels to represent
-          string line = get_command(din);
-          while(line!="\n") //It's \n when we read EOF
+          //Load everything as one batch, so the graph is checked for cycles once rather than after every edge.
+          to_construct.begin_batch();
+          try
           {
-               vector<string> tokens;
-               StringFunctions::tokenize(tokens,line);
-               if(!tokens.size())
-                    continue;
-               if(tokens.size()==1 || tokens[1]!="/")
-               {
-                    to_construct.add_set_symbol(mutator(tokens[0]),line.substr(tokens[0].size()+(tokens.size()==1 ? 0 : 1)));
-                    to_construct.set_callback(mutator(tokens[0]),dep_callback);
-               }
-               else
+               parse_interchange(data,size,[&](const Record& record)
                {
-                    if(tokens.size()!=3)
-                         throw "Invalid dependency specification.";
-                    add_if_not_present(mutator(tokens[0]), "");
-                    add_if_not_present(mutator(tokens[2]), "");
-                    if(mutator(tokens[2]).substr(0,3)=="../" && !to_construct.has_dependency(mutator(tokens[2]),mutator(tokens[0])))
-                         throw "Attempted to add dependency to symbol outside working directory.";
-                    to_construct.add_dependency(mutator(tokens[2]),mutator(tokens[0])); //yes the order is right
-               }
-               line = get_command(din);
+                    string name = mutator(record.first.str());
+                    switch(record.type)
+                    {
+                    case Record::ATTRIBUTE:
+                    {
+                         if(!(record.second=="restat"))
+                              throw "Invalid attribute specification.";
+                         add_if_not_present(name, "");
+                         restat_symbols.insert(name);
+                         break;
+                    }
+                    case Record::DEFINITION:
+                    {
+                         string value = record_value(record);
+                         to_construct.add_set_symbol(name,value);
+                         to_construct.set_callback(name,dep_callback);
+                         if(defined)
+                              defined(name,value);
+                         break;
+                    }
+                    case Record::DEPENDENCY:
+                    {
+                         string dependent = mutator(record.second.str());
+                         add_if_not_present(name, "");
+                         add_if_not_present(dependent, "");
+                         if(dependent.compare(0,3,"../")==0 && !to_construct.has_dependency(dependent,name))
+                              throw "Attempted to add dependency to symbol outside working directory.";
+                         to_construct.add_dependency(dependent,name); //yes the order is right
+                         break;
+                    }
+                    }
+               });
+          }
+          catch(const char* error)
+          {
+               to_construct.abort_batch();
+               throw;
           }
+          bake_trace::Span span("cycle check","graph");
+          to_construct.commit_batch();
      }
 
-     void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator)
+     void load_snapshot(const DepSnapshot& snapshot, DepSystem& to_construct) throw(const char*)
      {
+          snapshot.load_into(to_construct,&restat_symbols);
+          for(DepSnapshot::Index i=0; i<snapshot.get_symbol_count(); i++)
+               to_construct.set_callback(snapshot.get_name(i),dep_callback);
+     }
+
+     void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator, bool binary)
+     {
+          if(binary)
+               dout << BINARY_INTERCHANGE_MAGIC;
           vector<string> symbols = to_output.get_symbols();
+          set<string> left_out;
           for(const string& sym : symbols)
           {
-               dout << mutator(sym) << ' ' << to_output.get_value(sym) << endl;
+               string name = mutator(sym);
+               write_record(dout,Record::DEFINITION,name,to_output.get_value(sym),binary,left_out);
+               if(restat_symbols.count(sym))
+                    write_record(dout,Record::ATTRIBUTE,name,"restat",binary,left_out);
                for(const string& depsym : to_output.get_dependency_edges(sym))
-                    dout << mutator(depsym) << " / " << mutator(sym) << endl;
+                    write_record(dout,Record::DEPENDENCY,mutator(depsym),name,binary,left_out);
           }
+          warn_left_out(left_out);
      }
 
-     static int exec_wrapper(const vector<string>& tokens)
+     string convert_interchange(const string& data, bool binary) throw(const char*)
      {
-          char* filename = StringFunctions::permanent_c_str(tokens[0]);
-          char** args = new char*[tokens.size()+1];
-          for(int i=0; i<tokens.size(); i++)
-               args[i] = StringFunctions::permanent_c_str(tokens[i]);
-          args[tokens.size()]=NULL;
-          return execvp(filename,args);
+          ostringstream converted;
+          if(binary)
+               converted << BINARY_INTERCHANGE_MAGIC;
+          set<string> left_out;
+          parse_interchange(data.data(),data.size(),[&](const Record& record)
+          {
+               write_record(converted,record.type,record.first.str(),record.type==Record::DEFINITION ? record_value(record) : record.second.str(),binary,left_out);
+          });
+          warn_left_out(left_out);
+          return converted.str();
      }
 
-     pair<int,pid_t> bakery_execute(const string& command, const DepSystem& cmd_input)
+     //Splits command into the arguments for exec: the words of its first line, with each sentinel replaced by the lines it encloses.
+     static vector<string> command_arguments(const string& command) throw(const char*)
      {
-          //Get the arguments for exec in tokens[]
           vector<string> lines;
           vector<string> tokens;
           StringFunctions::strsplit(lines,command,"\n");
@@ -205,63 +500,193 @@ namespace bake_utilities
                {
                     string sentinel = tokens[i].substr(1);
                     tokens[i]="";
-                    while(lines[j]!=sentinel)
+                    while(j>=lines.size() || lines[j]!=sentinel)
                     {
                          if(j>=lines.size())
-                              throw "Unterminated sentinel: "+sentinel;
+                              throw StringFunctions::permanent_c_str("Unterminated sentinel: "+sentinel);
                          tokens[i]+=lines[j]+"\n";
                          j++;
                     }
                     j++;
                     tokens[i] = tokens[i].substr(0,tokens[i].size()-1);
                }
+          return tokens;
+     }
 
-          //Now we create pipes and do fork/exec
-          int to_child, to_parent;
-          int parent_writes[2];
-          int child_writes[2];
-          pipe(parent_writes);
-          pipe(child_writes);
-          pid_t child_id = fork();
+     /*Starts command with the file descriptor setup in actions and the environment env, returning its pid.
+       posix_spawn() lets the C library use vfork() or clone(CLONE_VFORK), so starting a job doesn't cost a copy of our page tables, which grow with the graph.*/
+     static pid_t spawn(const string& command, const posix_spawn_file_actions_t* actions, char* const* env = environ) throw(const char*)
+     {
+          vector<string> tokens = command_arguments(command);
+          if(!tokens.size())
+               throw StringFunctions::permanent_c_str(command+": empty command.");
+          vector<char*> args;
+          for(string& token : tokens)
+               args.push_back(&token[0]);
+          args.push_back(NULL);
 
-          if(child_id!=0) //we are the parent
-          {
-               //Set up pipe communication
-               to_child = parent_writes[1];
-               to_parent = child_writes[0];
-               close(parent_writes[0]);
-               close(child_writes[1]);
+          BAKE_COUNT(PROCESSES_SPAWNED,1);
+          pid_t child_id;
+          int error = posix_spawnp(&child_id,args[0],actions,NULL,args.data(),env);
+          if(error)
+               throw StringFunctions::permanent_c_str(tokens[0]+": could not execute: "+strerror(error));
+          return child_id;
+     }
 
-               //Set up ostream to child; call output_depsystem.
-               //This will block if the child does not read its pipe.
-               stdio_filebuf<char> child_out_(to_child,std::ios::out);
-               ostream child_out(&child_out_);
-               output_depsystem(child_out,cmd_input);
+     /*Writes input to to_child while reading from_child into output, until the child has closed its end of both, closing ours.
+       Waiting on whichever pipe is ready means a child that writes before it has read all its input can't deadlock with us.*/
+     static void exchange(int to_child, const string& input, int from_child, string& output)
+     {
+          fcntl(to_child,F_SETFL,O_NONBLOCK);
 
-               //Flush ostream, then close corresponding file descriptor
-               child_out.flush();
+          //A child that exits without reading all its input mustn't kill us with SIGPIPE.
+          sigset_t sigpipe, old_mask;
+          sigemptyset(&sigpipe);
+          sigaddset(&sigpipe,SIGPIPE);
+          pthread_sigmask(SIG_BLOCK,&sigpipe,&old_mask);
+          bool broken_pipe = false;
+
+          pollfd fds[2] = {{from_child,POLLIN,0},{input.size() ? to_child : -1,POLLOUT,0}};
+          if(!input.size())
                close(to_child);
+          size_t written = 0;
+          char buffer[65536];
+          while(fds[0].fd!=-1 || fds[1].fd!=-1)
+          {
+               if(poll(fds,2,-1)==-1)
+               {
+                    if(errno==EINTR)
+                         continue;
+                    break;
+               }
 
-               //Return child's ID and read end of child's pipe
-               return pair<int,pid_t>(to_parent,child_id);
+               if(fds[1].revents)
+               {
+                    ssize_t bytes_written = write(to_child,input.data()+written,input.size()-written);
+                    if(bytes_written>0)
+                         written += bytes_written;
+                    else if(errno!=EAGAIN && errno!=EINTR)
+                    {
+                         broken_pipe = errno==EPIPE;
+                         written = input.size(); //the child doesn't want the rest
+                    }
+                    if(written==input.size())
+                    {
+                         close(to_child);
+                         fds[1].fd = -1;
+                    }
+               }
+
+               if(fds[0].revents)
+               {
+                    ssize_t bytes_read = read(from_child,buffer,sizeof(buffer));
+                    if(bytes_read>0)
+                    {
+                         BAKE_COUNT(BYTES_FROM_CHILDREN,bytes_read);
+                         output.append(buffer,bytes_read);
+                    }
+                    else if(bytes_read==0 || errno!=EINTR)
+                    {
+                         close(from_child);
+                         fds[0].fd = -1;
+                    }
+               }
           }
-          else //we are the child
+          for(const pollfd& x : fds)
+               if(x.fd!=-1)
+                    close(x.fd);
+
+          //Take back the SIGPIPE a write raised, so it isn't delivered once we unblock it.
+          if(broken_pipe)
           {
-               //Set up pipe communication
-               to_child = parent_writes[0];
-               to_parent = child_writes[1];
-               close(parent_writes[1]);
-               close(child_writes[0]);
+               timespec no_wait = {0,0};
+               sigtimedwait(&sigpipe,NULL,&no_wait);
+          }
+          pthread_sigmask(SIG_SETMASK,&old_mask,NULL);
+     }
 
-               //Redirect pipes to standard in and standard out
-               dup2(to_child,STDIN_FILENO);
-               dup2(to_parent,STDOUT_FILENO);
+     pid_t bakery_spawn(const string& command) throw(const char*)
+     {
+          posix_spawn_file_actions_t actions;
+          posix_spawn_file_actions_init(&actions);
+          posix_spawn_file_actions_addopen(&actions,STDIN_FILENO,"/dev/null",O_RDONLY,0);
+          try
+          {
+               pid_t child_id = spawn(command,&actions);
+               posix_spawn_file_actions_destroy(&actions);
+               return child_id;
+          }
+          catch(const char* e)
+          {
+               posix_spawn_file_actions_destroy(&actions);
+               throw;
+          }
+     }
 
-               //Execute child: exec_wrapper() does not return if the child's main process is able to be executed.
-               exec_wrapper(tokens);
+     pid_t bakery_start(const string& command, int& to_child, int& from_child, bool binary) throw(const char*)
+     {
+          //The command is told which framing it reads, whatever we were told ourselves.
+          static char binary_setting[] = "BAKE_INTERCHANGE=binary";
+          vector<char*> env;
+          for(char** variable = environ; *variable; variable++)
+               if(strncmp(*variable,"BAKE_INTERCHANGE=",strlen("BAKE_INTERCHANGE="))!=0)
+                    env.push_back(*variable);
+          if(binary)
+               env.push_back(binary_setting);
+          env.push_back(NULL);
 
-               //If exec_wrapper() returns, it means something went wrong, most likely a typo in the Bakefile.  Exit with error.
-               exit(1);
+
+          //Our ends of the pipes mustn't leak into this child, or any other, or the child would never see EOF on its standard input.
+          int parent_writes[2];
+          int child_writes[2];
+          if(pipe2(parent_writes,O_CLOEXEC)==-1)
+               throw "Could not create pipe to command.";
+          if(pipe2(child_writes,O_CLOEXEC)==-1)
+          {
+               close(parent_writes[0]);
+               close(parent_writes[1]);
+               throw "Could not create pipe from command.";
           }
+
+          //dup2() clears close-on-exec, so the child keeps the ends it's given as standard input and output.
+          posix_spawn_file_actions_t actions;
+          posix_spawn_file_actions_init(&actions);
+          posix_spawn_file_actions_adddup2(&actions,parent_writes[0],STDIN_FILENO);
+          posix_spawn_file_actions_adddup2(&actions,child_writes[1],STDOUT_FILENO);
+          pid_t child_id;
+          try
+          {
+               child_id = spawn(command,&actions,env.data());
+          }
+          catch(const char* e)
+          {
+               posix_spawn_file_actions_destroy(&actions);
+               for(int fd : {parent_writes[0],parent_writes[1],child_writes[0],child_writes[1]})
+                    close(fd);
+               throw;
+          }
+          posix_spawn_file_actions_destroy(&actions);
+          close(parent_writes[0]);
+          close(child_writes[1]);
+
+          //Bigger pipes mean fewer trips through poll() for big graphs; it's fine if we can't have them.
+          to_child = parent_writes[1];
+          from_child = child_writes[0];
+          fcntl(to_child,F_SETPIPE_SZ,PIPE_SIZE);
+          fcntl(from_child,F_SETPIPE_SZ,PIPE_SIZE);
+          return child_id;
+     }
+
+     pid_t bakery_execute(const string& command, const DepSystem& cmd_input, string& output, bool binary) throw(const char*)
+     {
+          int to_child, from_child;
+          pid_t child_id = bakery_start(command,to_child,from_child,binary);
+
+          ostringstream serialized;
+          output_depsystem(serialized,cmd_input,[](string symname) noexcept { return symname; },binary);
+          string input = serialized.str();
+          BAKE_COUNT(BYTES_TO_CHILDREN,input.size());
+          exchange(to_child,input,from_child,output);
+          return child_id;
      }
 }
@@ -10,10 +10,23 @@ using std::pair;
 using std::queue;
 using std::tuple;
 
+class DepSnapshot;
+
 namespace bake_utilities
 {
      extern queue<tuple<string,pid_t,time_t>> wait_queue;
 
+     //Symbols given the restat attribute ("A ! restat"): their build commands may leave them untouched or rewrite them unchanged, and their dependents needn't be rebuilt if they do.
+     extern unordered_set<string> restat_symbols;
+
+     /*The Baker Interchange Format also has a binary framing, which a command is given, and may answer in, when its environment has BAKE_INTERCHANGE=binary.
+       A binary stream starts with this preamble, which text never does, since text never contains a NUL.  It's followed by records of three kinds:
+       'S' defines a symbol, 'D' makes a symbol depend on another, and 'A' gives a symbol an attribute.  Each is the type byte followed by two fields,
+       (symbol, value), (dependency, dependent), or (symbol, attribute), each field being its length, 4 bytes little-endian, and then its bytes.
+       Fields may hold any bytes, so names with whitespace and commands of several lines need no sentinels.
+       The preamble may appear again between records, as it does where binary streams are concatenated.*/
+     extern const string BINARY_INTERCHANGE_MAGIC;
+
      //Should only be needed by Baker.
      /*Given input stream, returns possibly multiline string containing the next command present in this stream.  Throws exception for the following conditions:
        1. Invalid backslash escape.
@@ -22,27 +35,58 @@ namespace bake_utilities
        4. Stream termination before sentinel reached.*/
      string get_command(istream& din) throw(const char*);
 
-     //Given input stream, DepSystem reference, and mutator (for use in Bakelib), augment the DepSystem with the data from the input stream, assumed to be in Baker Interchange Format.
+     //Given input stream, DepSystem reference, and mutator (for use in Bakelib), augment the DepSystem with the data from the input stream, assumed to be in Baker Interchange Format, as text or in its binary framing.
      //Sets values of symbols to their build commands, and sets dep_callback as the callback for any symbols with associated commands.
-     void augment_depsystem(istream& din, DepSystem& to_construct, function<string(string)> mutator = [](string symname) noexcept { return symname; }) throw(const char*);
+     //Symbols given attributes are added to the matching set above (such as restat_symbols).
+     //If given, defined is called with the (mutated) name and value of every symbol a line of the stream defines.
+     //Blank lines are skipped.
+     void augment_depsystem(istream& din, DepSystem& to_construct, function<string(string)> mutator = [](string symname) noexcept { return symname; },
+                            function<void(const string&,const string&)> defined = nullptr) throw(const char*);
+
+     //As above, but parses the size bytes at data in place, rather than a stream.
+     void augment_depsystem(const char* data, size_t size, DepSystem& to_construct, function<string(string)> mutator = [](string symname) noexcept { return symname; },
+                            function<void(const string&,const string&)> defined = nullptr) throw(const char*);
+
+     //Fills to_construct, which must be empty, from snapshot, as augment_depsystem() would from the output the snapshot was saved from: callbacks are set, and marked symbols are added to restat_symbols.
+     //Throws exception if to_construct is not empty.
+     void load_snapshot(const DepSnapshot& snapshot, DepSystem& to_construct) throw(const char*);
 
      //Given the passed reference to a DepSystem and passed reference to an ostream, outputs the DepSystem to the ostream in Baker Interchange Format.
      //Mutator mutates symbol names before transmittal.
-     //Throws exception if ostream is closed on it.
+     //Uses the binary framing if binary is set.  Throws exception if ostream is closed on it.
+     //Text can't represent names containing whitespace, or commands of several lines not enclosed in sentinels, which binary generators may give:
+     //when writing text, their records are left out, with a warning on standard error, so that commands reading text see the rest of the graph.
      //Directly imported into Bakelib.
-     void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator = [](string symname) noexcept { return symname; });
+     void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator = [](string symname) noexcept { return symname; }, bool binary = false);
+
+     //Returns data, which is in Baker Interchange Format, in the binary framing if binary is set and as text otherwise.
+     //Throws exception if data is malformed.  Records text can't represent are left out with a warning, as by output_depsystem().
+     string convert_interchange(const string& data, bool binary) throw(const char*);
 
      //Parses string parameter and executes it as a command using exec.
-     //Pipes the referenced DepSystem to the command's standard input.
-     //Returns the read end of another pipe and a pid_t with the PID of the child ready for wait() to be called on it.
+     //Pipes the referenced DepSystem to the command's standard input while collecting its standard output in output, writing and reading as each pipe is ready.
+     //The command is given the binary framing, and told so, if binary is set.
+     //Returns the PID of the child, which has closed its standard output, ready for wait() to be called on it.
+     //Throws exception if the command can't be executed.
      //Uses output_depsystem.
-     //Used by dep_callback.
-     //Also to be used by Baker's main file like this:
+     //To be used by Baker's main file like this:
      //1.  Call bakery_execute().
-     //2.  Create streambuf from file descriptor.
-     //3.  Create istream from streambuf.
+     //2.  Wait on the child.
+     //3.  Create istream from output.
      //4.  Call augment_depsystem.
-     pair<int,pid_t> bakery_execute(const string& command, const DepSystem& cmd_input = DepSystem());
+     pid_t bakery_execute(const string& command, const DepSystem& cmd_input, string& output, bool binary = false) throw(const char*);
+
+     //Parses string parameter and executes it as a command using exec, as bakery_execute() does, but leaves the pipes to us.
+     //Sets to_child to the write end of the command's standard input and from_child to the read end of its standard output, both close-on-exec.
+     //Sets BAKE_INTERCHANGE=binary in the command's environment if binary is set, and takes it out otherwise.
+     //Returns the PID of the child.  Throws exception if the command can't be executed.
+     pid_t bakery_start(const string& command, int& to_child, int& from_child, bool binary = false) throw(const char*);
+
+     //Parses string parameter and executes it as a command using exec, as bakery_execute() does, for a build job.
+     //The command reads /dev/null and writes to our standard output and error.
+     //Returns the PID of the child, ready for wait() to be called on it.  Throws exception if the command can't be executed.
+     //Used by dep_callback.
+     pid_t bakery_spawn(const string& command) throw(const char*);
 }
 
 #endif
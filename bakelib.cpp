@@ -1,10 +1,18 @@
 #include "bakelib.hpp"
+#include <cstdlib>
 #include <iostream>
 
 using std::cin;
+using std::getenv;
 
 namespace bakelib
 {
+     bool binary_interchange()
+     {
+          const char* interchange = getenv("BAKE_INTERCHANGE");
+          return interchange && string(interchange)=="binary";
+     }
+
      void construct_depsystem(DepSystem& to_construct, function<string(string)> mutator)
      {
           bake_utilities::augment_depsystem(cin,to_construct,mutator);
@@ -5,11 +5,14 @@
 
 namespace bakelib
 {
-     //Wrapper for bake_utilities::augment_depsystem
+     //Whether bake set BAKE_INTERCHANGE=binary for us: our standard input is in the binary framing, and our standard output may be.
+     bool binary_interchange();
+
+     //Wrapper for bake_utilities::augment_depsystem, which reads either framing
      void construct_depsystem(DepSystem& to_construct, function<string(string)> mutator = [](string symname) noexcept { return symname; });
 
-     //Direct importation
-     inline void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator = [](string symname) noexcept { return symname; }) { bake_utilities::output_depsystem(dout,to_output,mutator); }
+     //Direct importation, answering in the framing bake asked for
+     inline void output_depsystem(ostream& dout, const DepSystem& to_output, function<string(string)> mutator = [](string symname) noexcept { return symname; }, bool binary = binary_interchange()) { bake_utilities::output_depsystem(dout,to_output,mutator,binary); }
 }
 
 #endif
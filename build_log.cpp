@@ -0,0 +1,107 @@
+#include "build_log.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using std::ifstream;
+using std::istringstream;
+using std::ofstream;
+using std::rename;
+
+static const char* const LOG_HEADER = "# bake log v4";
+
+string BuildLog::path_for(const string& bakefile)
+{
+     size_t slash = bakefile.rfind('/');
+     if(slash==string::npos)
+          return ".bake_log";
+     return bakefile.substr(0,slash+1)+".bake_log";
+}
+
+void BuildLog::load(const string& path)
+{
+     entries.clear();
+
+     ifstream fin(path);
+     string line;
+     getline(fin,line);
+     if(!fin.good() || line!=LOG_HEADER)
+          return;
+
+     //Each line is "duration inputs_signature command_signature checked_seconds checked_nanoseconds target"; the target name is the rest of the line.
+     while(getline(fin,line))
+     {
+          istringstream fields(line);
+          Entry entry;
+          if(!(fields >> entry.duration_ms >> std::hex >> entry.inputs_signature >> entry.command_signature >> std::dec >> entry.checked_mtime.tv_sec >> entry.checked_mtime.tv_nsec) || fields.get()!=' ')
+               continue;
+          string target;
+          getline(fields,target);
+          if(target!="")
+               entries[target] = entry;
+     }
+}
+
+bool BuildLog::save(const string& path) const
+{
+     string temp_path = path+".tmp";
+     ofstream fout(temp_path);
+     fout << LOG_HEADER << '\n';
+     for(const auto& entry : entries)
+          if(entry.first.find('\n')==string::npos) //can't represent these; we'll just have to relearn them
+               fout << entry.second.duration_ms << ' ' << std::hex << entry.second.inputs_signature << ' ' << entry.second.command_signature << std::dec << ' '
+                    << entry.second.checked_mtime.tv_sec << ' ' << entry.second.checked_mtime.tv_nsec << ' ' << entry.first << '\n';
+     fout.close();
+
+     if(!fout.good())
+          return false;
+     return rename(temp_path.c_str(),path.c_str())==0;
+}
+
+const BuildLog::Entry* BuildLog::find(const string& target) const
+{
+     auto entry = entries.find(target);
+     return entry==entries.end() ? NULL : &entry->second;
+}
+
+//Entries are created knowing neither duration nor signatures, and never having been checked.
+static BuildLog::Entry& get_entry(unordered_map<string,BuildLog::Entry>& entries, const string& target)
+{
+     auto entry = entries.find(target);
+     if(entry==entries.end())
+          entry = entries.emplace(target,BuildLog::Entry{-1,0,0,{0,0}}).first;
+     return entry->second;
+}
+
+void BuildLog::set_duration(const string& target, long duration_ms)
+{
+     get_entry(entries,target).duration_ms = duration_ms;
+}
+
+void BuildLog::set_inputs_signature(const string& target, uint64_t inputs_signature)
+{
+     get_entry(entries,target).inputs_signature = inputs_signature;
+}
+
+void BuildLog::set_command_signature(const string& target, uint64_t command_signature)
+{
+     get_entry(entries,target).command_signature = command_signature;
+}
+
+void BuildLog::set_checked_mtime(const string& target, timespec checked_mtime)
+{
+     get_entry(entries,target).checked_mtime = checked_mtime;
+}
+
+long BuildLog::mean_duration() const
+{
+     long total = 0;
+     size_t count = 0;
+     for(const auto& entry : entries)
+          if(entry.second.duration_ms>=0)
+          {
+               total += entry.second.duration_ms;
+               count++;
+          }
+     return count ? total/(long)count : 0;
+}
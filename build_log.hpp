@@ -0,0 +1,52 @@
+#ifndef BUILD_LOG_HPP
+#define BUILD_LOG_HPP
+
+#include "deplib.hpp"
+#include <cstdint>
+#include <ctime>
+
+//Persistent record of what bake learned about each target on previous runs.
+//Lives next to the Bakefile as ".bake_log".
+class BuildLog
+{
+public:
+     struct Entry
+     {
+          long duration_ms; //wall-clock time of the target's last successful build, or -1 if unknown
+          uint64_t inputs_signature; //fingerprint of the contents of the target's dependencies when it was last brought up to date, or 0 if unknown
+          uint64_t command_signature; //fingerprint of the target's build command when it was last brought up to date, or 0 if unknown
+          timespec checked_mtime; //modification time of the newest of the target's dependencies when its build last left it untouched (see restat), or zero
+     };
+
+     //Returns the path of the log belonging to the passed Bakefile.
+     static string path_for(const string& bakefile);
+
+     //Replaces our entries with those in the log file at path.  A missing, unreadable, or outdated log file simply leaves us empty.
+     void load(const string& path);
+
+     //Writes our entries to path, replacing the file atomically.  Returns whether the log could be written.
+     bool save(const string& path) const;
+
+     //Returns entry for target, or NULL if we know nothing about it.
+     const Entry* find(const string& target) const;
+
+     //Records how long target took to build.
+     void set_duration(const string& target, long duration_ms);
+
+     //Records the fingerprint of target's dependencies as of when it was last brought up to date.
+     void set_inputs_signature(const string& target, uint64_t inputs_signature);
+
+     //Records the fingerprint of the command target was last brought up to date with.
+     void set_command_signature(const string& target, uint64_t command_signature);
+
+     //Records that target's build left it untouched, and so up to date with its dependencies as of checked_mtime.
+     void set_checked_mtime(const string& target, timespec checked_mtime);
+
+     //Returns the mean duration of all targets whose duration we have recorded, or 0 if there are none.
+     long mean_duration() const;
+
+private:
+     unordered_map<string,Entry> entries;
+};
+
+#endif
@@ -1,449 +1,688 @@
 #include "deplib.hpp"
 #include "StringFunctions.h"
+#include "bake_stats.hpp"
+#include "frozen_depsystem.hpp"
 #include <algorithm>
+#include <tuple>
 
+using std::any_of;
 using std::find;
 using std::find_if;
+using std::get;
+using std::pair;
+using std::sort;
+using std::tuple;
 using StringFunctions::peekline;
 
+//Markers kept in build_order_index while the build order is being computed
+static const size_t UNORDERED = -1;
+static const size_t ORDERING = -2;
+
+const DepSystem::Id DepSystem::NO_SYMBOL;
+
+//Returns whether ids contains x.
+static bool contains_id(const vector<StringInterner::Id>& ids, StringInterner::Id x)
+{
+     return find(ids.begin(),ids.end(),x)!=ids.end();
+}
+
+//Adds x to ids, a set, if it isn't there already.
+static void insert_id(vector<StringInterner::Id>& ids, StringInterner::Id x)
+{
+     if(!contains_id(ids,x))
+          ids.push_back(x);
+}
+
+//Removes x from ids, a set, if it's there.  Searches from the end, since the newest edges are the likeliest to go, as when a batch is undone.
+static void erase_id(vector<StringInterner::Id>& ids, StringInterner::Id x)
+{
+     for(size_t i=ids.size(); i--;)
+          if(ids[i]==x)
+          {
+               ids[i] = ids.back();
+               ids.pop_back();
+               return;
+          }
+}
+
+DepSystem::Id DepSystem::find_id(const string& name) const noexcept
+{
+     BAKE_COUNT(SYMBOL_LOOKUPS,1);
+     Id id = names.find(name);
+     return exists(id) ? id : NO_SYMBOL;
+}
+
+DepSystem::Symbol& DepSystem::find_symbol(const string& name, const char* error) throw(const char*)
+{
+     Id id = find_id(name);
+     if(id==NO_SYMBOL)
+          throw error;
+     return symbols[id];
+}
+
+const DepSystem::Symbol& DepSystem::find_symbol(const string& name, const char* error) const throw(const char*)
+{
+     Id id = find_id(name);
+     if(id==NO_SYMBOL)
+          throw error;
+     return symbols[id];
+}
+
+bool DepSystem::edge_exists(const Symbol& from, const Symbol& to) const
+{
+     if(from.dependency_edges.size() <= to.reverse_dependency_edges.size())
+          return contains_id(from.dependency_edges,to.id);
+     return contains_id(to.reverse_dependency_edges,from.id);
+}
+
+bool DepSystem::satisfies_list_of(Id symbol, const Symbol& owner) const
+{
+     return any_of(owner.dependency_list_list.begin(),owner.dependency_list_list.end(),[&](const vector<Id>& deplist)
+                   {
+                        auto satisfier = find_if(deplist.begin(),deplist.end(),[&](Id val) { return exists(val); });
+                        return satisfier!=deplist.end() && *satisfier==symbol;
+                   });
+}
+
+vector<string> DepSystem::get_names(const vector<Id>& ids) const
+{
+     vector<string> to_return;
+     to_return.reserve(ids.size());
+     for(Id id : ids)
+          to_return.push_back(names.get(id));
+     return to_return;
+}
+
+template<typename F> void DepSystem::for_each_dependency(const Symbol& symbol, F f) const
+{
+     for(Id dep : symbol.dependency_edges)
+          f(symbols[dep]);
+
+     for(const vector<Id>& dep_list : symbol.dependency_list_list)
+          for(Id list_sym : dep_list)
+               if(exists(list_sym))
+               {
+                    f(symbols[list_sym]);
+                    break;
+               }
+}
+
+void DepSystem::dependencies_changing(Id symbol)
+{
+     if(closure_cache.size())
+          for(Id affected : get_dependents_recursive(symbol))
+               closure_cache.erase(affected);
+}
+
+vector<vector<string>> DepSystem::update_build_order() const
+{
+     vector<vector<string>> cycles;
+     if(build_order_valid)
+          return cycles;
+
+     BAKE_COUNT(CYCLE_CHECKS,1);
+     build_order.clear();
+     build_order.reserve(symbols.size());
+     build_order_holes = 0;
+     for(const Symbol& x : symbols)
+          x.build_order_index = UNORDERED;
+
+     /*Iterative Tarjan: a depth-first search which appends each strongly connected component once everything it depends on has been appended.
+       In an acyclic graph every component is a single symbol, so this is a buildable order; any larger component is a cycle.
+       Each stack entry is a symbol, the symbol whose dependency it is, whether it has been expanded, and its preorder number.
+       A symbol may be on the stack more than once; only its first expansion counts, but every entry passes its lowlink on to the symbol depending on it.*/
+     vector<tuple<const Symbol*,const Symbol*,bool,size_t>> stack;
+     vector<const Symbol*> component_stack;
+     size_t next_preorder = 0;
+     auto pass_lowlink = [](const Symbol* from, const Symbol* to)
+          {
+               if(to && from->build_order_index==ORDERING && from->lowlink < to->lowlink)
+                    to->lowlink = from->lowlink;
+          };
+     for(const Symbol& root : symbols)
+     {
+          if(!root.exists)
+               continue;
+          stack.emplace_back(&root,nullptr,false,0);
+          while(stack.size())
+          {
+               const Symbol* current = get<0>(stack.back());
+               const Symbol* dependent = get<1>(stack.back());
+               if(get<2>(stack.back()))
+               {
+                    //Everything we depend on has been searched: if we couldn't reach back to a symbol still on the component stack, we head a component.
+                    size_t preorder = get<3>(stack.back());
+                    stack.pop_back();
+                    if(current->lowlink!=preorder)
+                    {
+                         pass_lowlink(current,dependent);
+                         continue;
+                    }
+
+                    //The component is everything above us on the component stack.
+                    if(component_stack.back()!=current)
+                    {
+                         vector<string> component;
+                         for(auto i = find(component_stack.begin(),component_stack.end(),current); i!=component_stack.end(); ++i)
+                              component.push_back(names.get((*i)->id));
+                         cycles.push_back(std::move(component));
+                    }
+                    const Symbol* member;
+                    do
+                    {
+                         member = component_stack.back();
+                         component_stack.pop_back();
+                         member->build_order_index = build_order.size();
+                         build_order.push_back(member->id);
+                    } while(member!=current);
+               }
+               else if(current->build_order_index!=UNORDERED)
+               {
+                    stack.pop_back();
+                    pass_lowlink(current,dependent);
+               }
+               else
+               {
+                    BAKE_COUNT(CYCLE_CHECK_NODES,1);
+                    get<2>(stack.back()) = true;
+                    get<3>(stack.back()) = current->lowlink = next_preorder++;
+                    current->build_order_index = ORDERING;
+                    component_stack.push_back(current);
+                    for_each_dependency(*current,[&](const Symbol& dep)
+                                        {
+                                             if(dep.build_order_index==UNORDERED)
+                                                  stack.emplace_back(&dep,current,false,0);
+                                             else
+                                                  pass_lowlink(&dep,current);
+                                        });
+               }
+          }
+     }
+
+     build_order_valid = !cycles.size();
+     return cycles;
+}
+
+bool DepSystem::detect_cycle(const Symbol& dependent, size_t upper_bound, vector<const Symbol*>& affected) const
+{
+     unordered_set<const Symbol*> visited{&dependent};
+     affected.push_back(&dependent);
+     for(size_t i=0; i<affected.size(); i++)
+     {
+          BAKE_COUNT(CYCLE_CHECK_NODES,1);
+          for(const vector<Id>* revdeps : {&affected[i]->reverse_dependency_edges,&affected[i]->reverse_dependency_list_set})
+               for(Id revdep_id : *revdeps)
+               {
+                    const Symbol& revdep = symbols[revdep_id];
+                    if(revdep.build_order_index==upper_bound)
+                         return true;
+                    if(revdep.build_order_index<upper_bound && visited.insert(&revdep).second)
+                         affected.push_back(&revdep);
+               }
+     }
+
+     return false;
+}
+
+bool DepSystem::order_dependency(const Symbol& dependency, const Symbol& dependent) const
+{
+     if(&dependency==&dependent)
+          return false;
+     if(batching) //checked all at once by commit_batch()
+          return true;
+
+     update_build_order();
+     size_t lower_bound = dependent.build_order_index;
+     size_t upper_bound = dependency.build_order_index;
+     if(upper_bound < lower_bound) //already in order
+          return true;
+
+     //Everything depending on dependent that is ordered before dependency has to move after dependency...
+     BAKE_COUNT(CYCLE_CHECKS,1);
+     vector<const Symbol*> moving_dependents;
+     if(detect_cycle(dependent,upper_bound,moving_dependents))
+          return false;
+
+     //...and everything dependency depends on that is ordered after dependent has to move before dependent.
+     vector<const Symbol*> moving_dependencies{&dependency};
+     unordered_set<const Symbol*> visited{&dependency};
+     for(size_t i=0; i<moving_dependencies.size(); i++)
+     {
+          BAKE_COUNT(CYCLE_CHECK_NODES,1);
+          for_each_dependency(*moving_dependencies[i],[&](const Symbol& dep)
+                              {
+                                   if(dep.build_order_index>lower_bound && visited.insert(&dep).second)
+                                        moving_dependencies.push_back(&dep);
+                              });
+     }
+
+     //Reuse the positions the moving symbols occupy: dependencies first, then dependents, each group keeping its relative order.
+     auto by_position = [](const Symbol* left, const Symbol* right) { return left->build_order_index < right->build_order_index; };
+     sort(moving_dependencies.begin(),moving_dependencies.end(),by_position);
+     sort(moving_dependents.begin(),moving_dependents.end(),by_position);
+     vector<size_t> positions;
+     for(const vector<const Symbol*>* group : {&moving_dependencies,&moving_dependents})
+          for(const Symbol* x : *group)
+               positions.push_back(x->build_order_index);
+     sort(positions.begin(),positions.end());
+
+     size_t next_position = 0;
+     for(const vector<const Symbol*>* group : {&moving_dependencies,&moving_dependents})
+          for(const Symbol* x : *group)
+          {
+               x->build_order_index = positions[next_position++];
+               build_order[x->build_order_index] = x->id;
+          }
+
+     return true;
+}
+
 bool DepSystem::has_symbol(const string& name) const noexcept
 {
-	 return symbols.count(Symbol{name});
+	 return find_id(name)!=NO_SYMBOL;
 }
 
 string DepSystem::get_value(const string& symbol_name) const throw(const char*)
 {
-	 if(!symbols.count(Symbol{symbol_name}))
-		  throw "get_value() called with nonexistent symbol name!";
-	 return symbols.find(Symbol{symbol_name})->value;
+	 return find_symbol(symbol_name,"get_value() called with nonexistent symbol name!").value;
 }
 
 void DepSystem::add_set_symbol(const string& name, const string& value) throw(const char*)
 {
-	 Symbol to_add{name,value,VALID};
-	 if(!symbols.count(to_add))
+	 Id existing = find_id(name);
+	 if(existing==NO_SYMBOL)
 	 {
-		  if(shadowers.count(name)) //handle case where we "shadow" less specific symbols
+		  Id id = names.intern(name);
+		  if(symbols.size()<=id)
+			   symbols.resize(id+1);
+		  Symbol& to_add = symbols[id];
+		  to_add.id = id;
+		  to_add.exists = true;
+		  to_add.value = value;
+		  to_add.state = VALID;
+		  if(batching)
+			   batch_undo.push_back([this,id]() { delete_symbol(names.get(id)); });
+		  if(build_order_valid)
+		  {
+			   to_add.build_order_index = build_order.size();
+			   build_order.push_back(id);
+		  }
+
+		  if(shadowers.count(id)) //handle case where we "shadow" less specific symbols
 		  {
-			   auto shadow_range = shadowers.equal_range(name); //all symbols listing us as a shadower
+			   auto shadow_range = shadowers.equal_range(id); //all symbols listing us as a shadower
 			   for(auto i = shadow_range.first; i!=shadow_range.second; ++i)
 			   {
-					Symbol affected = *symbols.find(Symbol{i->second}); //a symbol who said we would be a shadower
-					for(vector<string> deplist : affected.dependency_list_list)
+					dependencies_changing(i->second); //we may become its dependency
+					const Symbol& affected = symbols[i->second]; //a symbol who said we would be a shadower
+					for(const vector<Id>& deplist : affected.dependency_list_list)
 					{
 						 //We find our name in the affected symbol's list so we can find the symbol we shadow, if any
-						 auto pos = find_if(deplist.begin(),deplist.end(),[&](const string& val) { return symbols.count(Symbol{val}) || val==name; });
-						 if(pos==deplist.end() || *pos!=name)
+						 //(we already exist, so we match ourselves.)
+						 auto pos = find_if(deplist.begin(),deplist.end(),[&](Id val) { return exists(val); });
+						 if(pos==deplist.end() || *pos!=id)
 							  continue;
 
-						 //Okay, we found ourselves: now find the shadowed symbol
-						 pos = find_if(pos,deplist.end(), [&](const string& val) { return symbols.count(Symbol{val}); });
+						 //Okay, we found ourselves: now find the shadowed symbol, which isn't us, should the list name us twice
+						 pos = find_if(pos+1,deplist.end(), [&](Id val) { return val!=id && exists(val); });
 
 						 //There might not be a shadowed symbol.
 						 /*If there is, erase its reverse dependency on the affected symbol.
 						   We are shadowing it: we take that reverse dependency for ourselves.
+						   Unless, that is, it still satisfies another of the affected symbol's lists, which still needs the reverse dependency.
 						 */
-						 if(pos!=deplist.end())
-						 {
-							  Symbol shadowed = *symbols.find(Symbol{*pos});
-							  shadowed.reverse_dependency_list_set.erase(affected.name);
-							  symbols.erase(shadowed);
-							  symbols.insert(shadowed);
-						 }
+						 if(pos!=deplist.end() && !satisfies_list_of(*pos,affected))
+							  erase_id(symbols[*pos].reverse_dependency_list_set,affected.id);
 
 						 //Add the reverse dependency on the affected symbol to our own revdep list set.
-						 to_add.reverse_dependency_list_set.insert(affected.name);
+						 //We're new and depend on nothing, so this can't make a cycle.
+						 insert_id(to_add.reverse_dependency_list_set,affected.id);
+						 order_dependency(to_add,affected);
 					}
 			   }
 
 			   //Since we are being added, we are no longer a (potential, nonexistent at the present time) shadower.
-			   shadowers.erase(name);
+			   shadowers.erase(id);
 		  }
-		  
-		  //We're a new symbol: add ourselves to the symbols set.
-		  symbols.insert(to_add);
 
 		  //We may have dependents already due to dependency lists: if we do, we need to invalidate them.
-		  invalidate_dependents(name);
+		  invalidate_dependents_of(id);
 	 }
-	 else if(symbols.find(to_add)->value==value) //nothing to do: this is a no-op
+	 else if(symbols[existing].value==value) //nothing to do: this is a no-op
 		  return;
-	 else //We're not new, but we changed our value: replace ourselves in symbols set.
+	 else //We're not new, but we changed our value: modify ourselves in place.
 	 {
-		  //Get to_add from symbols set and make necessary modifications
-		  to_add = *symbols.find(to_add);
-		  to_add.value = value;
+		  Symbol& to_modify = symbols[existing];
+		  to_modify.value = value;
 
 		  //See if our new status should be DISABLED or VALID.
 		  //If we have dependents, we need to be DISABLED; otherwise, VALID.
-		  if(to_add.dependency_edges.size() || [&]()
-			 {    for(auto deplist : to_add.dependency_list_list)
-					   for(string depsym : deplist)
-							if(symbols.count(Symbol{depsym}))
+		  if(to_modify.dependency_edges.size() || [&]()
+			 {    for(const vector<Id>& deplist : to_modify.dependency_list_list)
+					   for(Id depsym : deplist)
+							if(exists(depsym))
 								 return true;
 				  return false; }())
-			   to_add.state = DISABLED;
+			   to_modify.state = DISABLED;
 		  else
-			   to_add.state = VALID;
+			   to_modify.state = VALID;
 
-		  //Reinsert ourselves into symbols set.
-		  symbols.erase(to_add);
-		  symbols.insert(to_add);
-
-		  invalidate_dependents(name); //we changed: invalidate our dependents
+		  invalidate_dependents_of(existing); //we changed: invalidate our dependents
 	 }
 }
 
 void DepSystem::delete_symbol(const string& name) throw(const char*)
 {
-	 if(!symbols.count(Symbol{name}))
+	 Id id = find_id(name);
+	 if(id==NO_SYMBOL)
 		  throw "delete_symbol() called with nonexistent symbol name!";
 
-	 auto ptr_erase = symbols.find(Symbol{name});
-	 Symbol to_delete = *ptr_erase;
-
-	 //First, delete ourselves from the symbols array.
-	 symbols.erase(to_delete);
+	 //Everything depending on us is about to lose a dependency.
+	 dependencies_changing(id);
 
-	 //Delete ourselves from the reverse dependency lists of our dependencies
-	 for(const string& dependency : to_delete.dependency_edges)
+	 //First, delete ourselves, leaving an empty Symbol for our name.  We're going away, so we can take our edges with us rather than copying them.
+	 Symbol to_delete = std::move(symbols[id]);
+	 symbols[id] = Symbol();
+	 symbols[id].id = id;
+	 if(build_order_valid)
 	 {
-		  Symbol to_modify = *symbols.find(Symbol{dependency});
-		  to_modify.reverse_dependency_edges.erase(name);
-		  symbols.erase(to_modify);
-		  symbols.insert(to_modify);
+		  build_order[to_delete.build_order_index] = NO_SYMBOL;
+		  if(++build_order_holes > build_order.size()/2)
+			   build_order_valid = false;
 	 }
 
+	 //Delete ourselves from the reverse dependency lists of our dependencies
+	 for(Id dependency : to_delete.dependency_edges)
+		  erase_id(symbols[dependency].reverse_dependency_edges,id);
+
 	 //Now delete ourselves from the dependency lists of our reverse dependencies
-	 for(string revdep : to_delete.reverse_dependency_edges)
+	 for(Id revdep : to_delete.reverse_dependency_edges)
+		  erase_id(symbols[revdep].dependency_edges,id);
+
+	 //Our own dependency lists go with us, so their satisfiers no longer have us as a dependent.
+	 for(const vector<Id>& deplist : to_delete.dependency_list_list)
 	 {
-		  Symbol to_modify = *symbols.find(Symbol{revdep});
-		  to_modify.dependency_edges.erase(name);
-		  symbols.erase(to_modify);
-		  symbols.insert(to_modify);
-	 }	 
+		  auto satisfier = find_if(deplist.begin(),deplist.end(),[&](Id val) { return exists(val); });
+		  if(satisfier!=deplist.end())
+			   erase_id(symbols[*satisfier].reverse_dependency_list_set,id);
+	 }
 
 	 //Now populate the shadowers array with our lower-priority surrogates.
-	 //Since we already deleted ourselves from the symbols set,
+	 //Since we no longer exist,
 	 //this code will also serve to add ourselves to the shadowers array.
-	 for(string deplist_owner_ : to_delete.reverse_dependency_list_set)
+	 vector<pair<Id,Id>> takeovers; //each symbol taking over one of our lists, and the list's owner
+	 for(Id deplist_owner_ : to_delete.reverse_dependency_list_set)
 	 {
-		  Symbol deplist_owner = *symbols.find(Symbol{deplist_owner_});
-		  for(vector<string> deplist : deplist_owner.dependency_list_list)
-			   for(auto i = find(deplist.begin(),deplist.end(),name); i!=deplist.end(); ++i)
-					if(!symbols.count(Symbol{*i}))
+		  const Symbol& deplist_owner = symbols[deplist_owner_];
+		  for(const vector<Id>& deplist : deplist_owner.dependency_list_list)
+		  {
+			   //Only lists we were satisfying are affected.
+			   auto i = find(deplist.begin(),deplist.end(),id);
+			   if(find_if(deplist.begin(),i,[&](Id val) { return exists(val); })!=i)
+					continue;
+
+			   for(; i!=deplist.end(); ++i)
+					if(!exists(*i))
 						 shadowers.emplace(*i,deplist_owner_);
 					else
+					{
+						 //The next symbol in the list takes over for us.
+						 insert_id(symbols[*i].reverse_dependency_list_set,deplist_owner_);
+						 takeovers.emplace_back(*i,deplist_owner_);
 						 break;
+					}
+		  }
+	 }
+
+	 /*Pearce-Kelly places one new edge in an order that is valid for every other edge.
+	   If our deletion made several, ordering them one at a time would start from an order that isn't, so compute it afresh instead.*/
+	 if(takeovers.size()==1)
+	 {
+		  if(!order_dependency(symbols[takeovers[0].first],symbols[takeovers[0].second])) //dependency lists made a cycle: settle for a best-effort order
+			   build_order_valid = false;
 	 }
+	 else if(takeovers.size())
+		  build_order_valid = false;
 }
 
 void DepSystem::clear()
 {
 	 symbols.clear();
 	 shadowers.clear();
+	 names.clear(); //dropping the arena frees every name at once
+	 build_order.clear();
+	 build_order_holes = 0;
+	 build_order_valid = true; //nothing to order
+	 closure_cache.clear();
+	 batch_undo.clear(); //nothing left to undo
 }
 
-DepSystem::Symbol_State DepSystem::get_state(const string& symbol_name) const throw(const char*)
+void DepSystem::begin_batch() throw(const char*)
 {
-	 auto symbol = symbols.find(Symbol{symbol_name});
-	 if(symbol==symbols.end())
-		  throw "get_state() called with nonexistent symbol.";
+	 if(batching)
+		  throw "begin_batch() called during a batch.";
 
-	 return symbol->state;
+	 //The build order and cached closures won't survive the batch anyway, so stop maintaining them.
+	 build_order_valid = false;
+	 closure_cache.clear();
+	 batching = true;
 }
 
-vector<string> DepSystem::select_syms_with_states(const vector<string>& buildlist, const initializer_list<Symbol_State>& states) const
+void DepSystem::commit_batch() throw(const char*)
 {
-	 bool state_table[VALID+1] = {false};
-	 for(Symbol_State state : states)
-		  state_table[state] = true;
+	 if(!batching)
+		  throw "commit_batch() called outside a batch.";
 
-	 vector<string> to_return;
-	 for(string x : buildlist)
-		  if(state_table[symbols.find(Symbol{x})->state])
-			   to_return.push_back(x);
-	 
-	 return to_return;
+	 vector<vector<string>> cycles = update_build_order();
+	 if(!cycles.size())
+	 {
+		  batching = false;
+		  batch_undo.clear();
+		  return;
+	 }
+
+	 abort_batch();
+	 string error = "Attempted to add cyclic dependencies:";
+	 for(const vector<string>& cycle : cycles)
+	 {
+		  error += "\n ";
+		  for(const string& member : cycle)
+			   error += " "+member;
+	 }
+	 throw StringFunctions::permanent_c_str(error);
 }
 
-void DepSystem::set_state(const string& symbol_name, Symbol_State new_state) throw(const char*)
+void DepSystem::abort_batch()
 {
-	 auto symbol = symbols.find(Symbol{symbol_name});
-	 if(symbol==symbols.end())
-		  throw "set_state() called with nonexistent symbol.";
+	 if(!batching)
+		  return;
 
-	 Symbol to_modify = *symbol;
-	 to_modify.state = new_state;
-	 symbols.erase(to_modify);
-	 symbols.insert(to_modify);
+	 //Undo in reverse, so every undo sees the graph as it was right after the change it undoes.
+	 //We're still in the batch while we do, so a graph left cyclic by the changes not yet undone doesn't get in the way.
+	 //An undo fails if whatever it undoes was already deleted later in the batch, which is just as good.
+	 for(auto undo = batch_undo.rbegin(); undo!=batch_undo.rend(); ++undo)
+		  try
+		  {
+			   (*undo)();
+		  }
+		  catch(const char* already_gone) {}
+	 batching = false;
+	 batch_undo.clear();
+	 build_order_valid = false;
+	 closure_cache.clear();
 }
 
-void DepSystem::set_callback(const string& symbol_name, function<void(string,string)> callback)
+DepSystem::Symbol_State DepSystem::get_state(const string& symbol_name) const throw(const char*)
 {
-	 auto symbol_ = symbols.find(Symbol{symbol_name});
-	 if(symbol_==symbols.end())
-		  throw "set_callback() called with nonexistent symbol.";
-
-	 Symbol symbol = *symbol_;
-	 symbol.callback = callback;
-
-	 symbols.erase(symbol);
-	 symbols.insert(symbol);
+	 return find_symbol(symbol_name,"get_state() called with nonexistent symbol.").state;
 }
 
-bool DepSystem::detect_cycle(const string& detect_from, const string& cycle_member) const
+vector<string> DepSystem::select_syms_with_states(const vector<string>& buildlist, const initializer_list<Symbol_State>& states) const throw(const char*)
 {
-     if(detect_from==cycle_member)
-          return true;
+	 bool state_table[VALID+1] = {false};
+	 for(Symbol_State state : states)
+		  state_table[state] = true;
 
-     auto from_symbol_ = symbols.find(Symbol{detect_from});
-     Symbol from_symbol = *from_symbol_;
+	 vector<string> to_return;
+	 for(const string& x : buildlist)
+		  if(state_table[find_symbol(x,"select_syms_with_states() called with nonexistent symbol.").state])
+			   to_return.push_back(x);
 
-     for(const string& dep_sym_name : from_symbol.dependency_edges)
-          if(dep_sym_name == cycle_member)
-               return true;
-          else if(detect_cycle(dep_sym_name,cycle_member))
-               return true;
+	 return to_return;
+}
 
-     for(const vector<string>& dep_list : from_symbol.dependency_list_list)
-          for(const string& list_sym_name : dep_list)
-               if(symbols.count(Symbol{list_sym_name}))
-               {
-                    if(detect_cycle(list_sym_name,cycle_member))
-                         return true;
-                    break;
-               }
+void DepSystem::set_state(const string& symbol_name, Symbol_State new_state) throw(const char*)
+{
+	 find_symbol(symbol_name,"set_state() called with nonexistent symbol.").state = new_state;
+}
 
-     return false;
+void DepSystem::set_callback(const string& symbol_name, function<void(string,string)> callback)
+{
+	 find_symbol(symbol_name,"set_callback() called with nonexistent symbol.").callback = callback;
 }
 
 void DepSystem::add_dependency(const string& from_name, const string& to_name) throw(const char*)
 {
-	 auto from_symbol_ = symbols.find(Symbol{from_name});
-	 if(from_symbol_==symbols.end())
-		  throw "add_dependency() called with nonexistent from symbol name.";
-
-	 auto to_symbol_ = symbols.find(Symbol{to_name});
-	 if(to_symbol_==symbols.end())
-		  throw "add_dependency() called with nonexistent to symbol name.";
+	 Symbol& from_symbol = find_symbol(from_name,"add_dependency() called with nonexistent from symbol name.");
+	 Symbol& to_symbol = find_symbol(to_name,"add_dependency() called with nonexistent to symbol name.");
 
-	 Symbol from_symbol = *from_symbol_;
-	 from_symbol.dependency_edges.insert(to_name);
+	 if(edge_exists(from_symbol,to_symbol))
+		  return;
 
-	 Symbol to_symbol = *to_symbol_;
-	 to_symbol.reverse_dependency_edges.insert(from_name);
+	 //Make room for the edge in the build order first: if there isn't any, it would be a cycle.
+	 if(!order_dependency(to_symbol,from_symbol))
+		  throw StringFunctions::permanent_c_str(string("Attempted to add cyclic dependency: ")+from_name+" / "+to_name);
 
-	 for(auto symbol : {from_symbol,to_symbol})
+	 dependencies_changing(from_symbol.id);
+	 from_symbol.dependency_edges.push_back(to_symbol.id);
+	 to_symbol.reverse_dependency_edges.push_back(from_symbol.id);
+	 if(batching)
 	 {
-		  symbols.erase(symbol);
-		  symbols.insert(symbol);
+		  Id from = from_symbol.id, to = to_symbol.id;
+		  batch_undo.push_back([this,from,to]() { delete_dependency(names.get(from),names.get(to)); });
 	 }
-
-     if(detect_cycle(to_name,from_name))
-     {
-          delete_dependency(from_name,to_name);
-          throw (string("Attempted to add cyclic dependency: ")+from_name+" / "+to_name).c_str();
-     }
 }
 
 bool DepSystem::has_dependency(const string& from_name, const string& to_name) const throw(const char*)
 {
-	 auto from_symbol_ = symbols.find(Symbol{from_name});
-	 if(from_symbol_==symbols.end())
-		  throw "has_dependency() called with nonexistent from symbol name.";
-
-	 auto to_symbol_ = symbols.find(Symbol{to_name});
-	 if(to_symbol_==symbols.end())
-		  throw "has_dependency() called with nonexistent to symbol name.";
+	 const Symbol& from_symbol = find_symbol(from_name,"has_dependency() called with nonexistent from symbol name.");
+	 const Symbol& to_symbol = find_symbol(to_name,"has_dependency() called with nonexistent to symbol name.");
 
-	 Symbol from_symbol = *from_symbol_;
-	 return from_symbol.dependency_edges.count(to_name);
+	 return edge_exists(from_symbol,to_symbol);
 }
 
 void DepSystem::delete_dependency(const string& from_name, const string& to_name) throw(const char*)
 {
-	 auto from_symbol_ = symbols.find(Symbol{from_name});
-	 if(from_symbol_==symbols.end())
-		  throw "delete_dependency() called with nonexistent from symbol name.";
-
-	 auto to_symbol_ = symbols.find(Symbol{to_name});
-	 if(to_symbol_==symbols.end())
-		  throw "delete_dependency() called with nonexistent to symbol name.";
-
-	 Symbol from_symbol = *from_symbol_;
-	 from_symbol.dependency_edges.erase(to_name);
+	 Symbol& from_symbol = find_symbol(from_name,"delete_dependency() called with nonexistent from symbol name.");
+	 Symbol& to_symbol = find_symbol(to_name,"delete_dependency() called with nonexistent to symbol name.");
 
-	 Symbol to_symbol = *to_symbol_;
-	 to_symbol.reverse_dependency_edges.erase(from_name);
-
-	 for(auto symbol : {from_symbol,to_symbol})
-	 {
-		  symbols.erase(symbol);
-		  symbols.insert(symbol);
-	 }
+	 dependencies_changing(from_symbol.id);
+	 erase_id(from_symbol.dependency_edges,to_symbol.id);
+	 erase_id(to_symbol.reverse_dependency_edges,from_symbol.id);
 }
 
-void DepSystem::add_dependency_list(const vector<string>& deplist, const string& to_symbol_name) throw(const char*)
+void DepSystem::add_dependency_list(const vector<string>& deplist_names, const string& to_symbol_name) throw(const char*)
 {
-	 auto to_symbol_ = symbols.find(Symbol{to_symbol_name});
-	 if(to_symbol_==symbols.end())
-		  throw "add_dependency_list() called with nonexistent symbol name.";
-	 Symbol to_symbol = *to_symbol_;
+	 Symbol& to_symbol = find_symbol(to_symbol_name,"add_dependency_list() called with nonexistent symbol name.");
+	 vector<Id> deplist;
+	 for(const string& member : deplist_names)
+		  deplist.push_back(names.intern(member));
+
+	 //Find the symbol which will satisfy the list, and check that depending on it won't make a cycle.
+	 auto first_existing = find_if(deplist.begin(),deplist.end(),[&](Id val) { return exists(val); });
+	 if(first_existing!=deplist.end() && !order_dependency(symbols[*first_existing],to_symbol))
+		  throw StringFunctions::permanent_c_str(string("Attempted to add cyclic dependency list to ")+to_symbol_name);
+	 dependencies_changing(to_symbol.id);
 
 	 //Add necessary symbols to shadowers map
-	 string first_existing_symbol = ""; //so no, you can't use the empty string as a symbol name
-	 for(string i : deplist)
-		  if(!symbols.count(Symbol{i}))
-			   shadowers.emplace(i,to_symbol_name);
-		  else
-		  {
-			   first_existing_symbol = i;
-			   break;
-		  }
+	 Id first_existing_symbol = first_existing==deplist.end() ? NO_SYMBOL : *first_existing;
+	 for(auto i = deplist.begin(); i!=first_existing; ++i)
+		  shadowers.emplace(*i,to_symbol.id);
 
 	 //Add deplist to to_symbol's deplist_list
-	 to_symbol.dependency_list_list.push_back(deplist);
-
-	 //If list is satisfied by a symbol, create appropriate entry in satisfying symbol's revdep_list_set
-	 if(first_existing_symbol!="")
+	 to_symbol.dependency_list_list.push_back(std::move(deplist));
+	 if(batching)
 	 {
-		  Symbol sym = *symbols.find(Symbol{first_existing_symbol});
-		  sym.reverse_dependency_list_set.insert(to_symbol_name);
-		  symbols.erase(sym);
-		  symbols.insert(sym);
+		  int index = to_symbol.dependency_list_list.size()-1;
+		  batch_undo.push_back([this,index,to_symbol_name]() { delete_dependency_list(index,to_symbol_name); });
 	 }
 
-	 //Update to_symbol's entry in symbols set.
-	 symbols.erase(to_symbol);
-	 symbols.insert(to_symbol);
+	 //If list is satisfied by a symbol, create appropriate entry in satisfying symbol's revdep_list_set
+	 if(first_existing_symbol!=NO_SYMBOL)
+		  insert_id(symbols[first_existing_symbol].reverse_dependency_list_set,to_symbol.id);
 }
 
 void DepSystem::delete_dependency_list(int index, const string& to_name)
 {
-	 auto sym_ = symbols.find(Symbol{to_name});
-	 if(sym_==symbols.end())
-		  throw "delete_dependency_list() called with nonexistent sym name.";
-
-	 Symbol sym = *sym_;
+	 Symbol& sym = find_symbol(to_name,"delete_dependency_list() called with nonexistent sym name.");
 	 if(index < 0 || index >= sym.dependency_list_list.size())
 		  throw "delete_dependency_list() called with invalid index.";
+	 dependencies_changing(sym.id);
 
 	 //Get list to delete, delete from sym.
-	 vector<string> list_to_delete = sym.dependency_list_list[index];
+	 vector<Id> list_to_delete = std::move(sym.dependency_list_list[index]);
 	 sym.dependency_list_list.erase(sym.dependency_list_list.begin()+index);
 
 	 //Find active symbol, if any.
-	 string active_symbol = "";
-	 for(string i : list_to_delete)
-		  if(symbols.count(Symbol{i}))
-		  {
-			   active_symbol = i;
-			   break;
-		  }
+	 auto active_symbol = find_if(list_to_delete.begin(),list_to_delete.end(),[&](Id val) { return exists(val); });
 
 	 //Check to see if we should delete ourselves from active_symbol's revdep list set.
 	 //We should do so iff active_symbol is not also the active symbol for another of our deplist.
-	 if(active_symbol!="")
-	 {
-		  bool delete_revdep = true;
-		  for(vector<string> deplist : sym.dependency_list_list)
-			   for(string i : deplist)
-					if(symbols.count(Symbol{i}))
-					{
-						 delete_revdep = false;
-						 break;
-					}
-
-		  if(delete_revdep)
-		  {
-			   Symbol revdep = *symbols.find(Symbol{active_symbol});
-			   revdep.reverse_dependency_list_set.erase(to_name);
-			   symbols.erase(revdep);
-			   symbols.insert(revdep);
-		  }
-	 }
-
-	 //Replace sym in symbols set
-	 symbols.erase(sym);
-	 symbols.insert(sym);
+	 if(active_symbol!=list_to_delete.end() && !satisfies_list_of(*active_symbol,sym))
+		  erase_id(symbols[*active_symbol].reverse_dependency_list_set,sym.id);
 }
 
 vector<vector<string>> DepSystem::get_dependency_lists(const string& to_symbol) const throw(const char*)
 {
-	 auto sym = symbols.find(Symbol{to_symbol});
-	 if(sym==symbols.end())
-		  throw "get_dependency_lists() called with nonexistent sym name.";
-
-	 return sym->dependency_list_list;
+	 vector<vector<string>> to_return;
+	 for(const vector<Id>& deplist : find_symbol(to_symbol,"get_dependency_lists() called with nonexistent sym name.").dependency_list_list)
+		  to_return.push_back(get_names(deplist));
+	 return to_return;
 }
 
 
-vector<string> DepSystem::get_dependencies_recursive(const Symbol& symbol, unordered_set<string> considered_symbols) const throw(const char*)
+vector<DepSystem::Id> DepSystem::get_dependencies_recursive(const Symbol& symbol) const throw(const char*)
 {
-	 vector<string> to_return;
-
-	 //If we've already considered this symbol, return empty vector
-	 if(considered_symbols.count(symbol.name))
-		  return vector<string>{};
-
-	 //Deal with dependencies
-	 for(const string& dep_sym_name : symbol.dependency_edges)
-	 {
-		  vector<string> dep_deps = get_dependencies_recursive(*symbols.find(Symbol{dep_sym_name}),considered_symbols);
-
-		  //Only insert into to_return vector if not in considered_symbols
-		  for(string x : dep_deps)
-			   if(!considered_symbols.count(x))
-					to_return.push_back(x);
-
-		  //Add dep_deps to considered_symbols set
-		  considered_symbols.insert(dep_deps.begin(),dep_deps.end());
-	 }
-
-	 //Deal with dependency lists
-	 for(vector<string> dep_list : symbol.dependency_list_list)
-		  for(string list_sym_name : dep_list)
-			   if(symbols.count(Symbol{list_sym_name}))
-			   {
-					vector<string> dep_deps = get_dependencies_recursive(*symbols.find(Symbol{list_sym_name}),considered_symbols);
-
-					//Only insert into to_return vector if not in considered_symbols
-					for(string x : dep_deps)
-						 if(!considered_symbols.count(x))
-							  to_return.push_back(x);
-
-					//Add dep_deps to considered_symbols set
-					considered_symbols.insert(dep_deps.begin(),dep_deps.end());
-					break;
-			   }
-
-	 //Add ourselves to the end of the to_return list (base case!)
-	 to_return.push_back(symbol.name);
+	 BAKE_COUNT(DEPENDENCY_CLOSURES,1);
+	 auto cached = closure_cache.find(symbol.id);
+	 if(cached!=closure_cache.end())
+		  return cached->second;
+
+	 update_build_order();
+
+	 //Collect ourselves and everything we depend on, visiting each symbol once no matter how many paths lead to it...
+	 vector<const Symbol*> closure{&symbol};
+	 unordered_set<const Symbol*> considered_symbols{&symbol};
+	 for(size_t i=0; i<closure.size(); i++)
+		  for_each_dependency(*closure[i],[&](const Symbol& dep)
+							  {
+								   if(considered_symbols.insert(&dep).second)
+										closure.push_back(&dep);
+							  });
+
+	 //...then put it all in build order, which leaves ourselves at the end.
+	 sort(closure.begin(),closure.end(),[](const Symbol* left, const Symbol* right) { return left->build_order_index < right->build_order_index; });
+
+	 vector<Id>& to_return = closure_cache[symbol.id];
+	 to_return.reserve(closure.size());
+	 for(const Symbol* x : closure)
+		  to_return.push_back(x->id);
 
 	 return to_return;
 }
 
 vector<string> DepSystem::get_dependencies(const string& symbol, function<bool(string,string,Symbol_State)> selector) const throw(const char*)
 {
-	 auto sym_ = symbols.find(Symbol{symbol});
-	 if(sym_==symbols.end())
-		  throw "get_dependencies() called with nonexistent sym name.";
-
-	 //Make recursive call
-	 vector<string> to_return = get_dependencies_recursive(*sym_,{});
+	 vector<Id> all_dependencies = get_dependencies_recursive(find_symbol(symbol,"get_dependencies() called with nonexistent sym name."));
 
-	 //Per our API, delete ourselves from the end of the dependency list
-	 to_return.pop_back();
-
-	 for(int i=0; i<to_return.size(); i++)
+	 //Per our API, leave out ourselves from the end of the dependency list
+	 vector<string> to_return;
+	 for(size_t i=0; i+1<all_dependencies.size(); i++)
 	 {
-		  const Symbol& deplist_sym = *symbols.find(Symbol{to_return[i]});
-		  if(!selector(deplist_sym.name,deplist_sym.value,deplist_sym.state))
-		  {
-			   to_return.erase(to_return.begin()+i);
-			   i--;
-		  }
+		  const Symbol& deplist_sym = symbols[all_dependencies[i]];
+		  string name = names.get(deplist_sym.id);
+		  if(selector(name,deplist_sym.value,deplist_sym.state))
+			   to_return.push_back(std::move(name));
 	 }
 
 	 return to_return;
@@ -451,59 +690,70 @@ vector<string> DepSystem::get_dependencies(const string& symbol, function<bool(s
 
 unordered_set<string> DepSystem::get_dependency_edges(const string& symbol) const
 {
-     auto sym_ = symbols.find(Symbol{symbol});
-	 if(sym_==symbols.end())
-		  throw "get_dependency_edges() called with nonexistent sym name.";
-
-     return sym_->dependency_edges;
+     unordered_set<string> to_return;
+     for(Id dep : find_symbol(symbol,"get_dependency_edges() called with nonexistent sym name.").dependency_edges)
+          to_return.insert(names.get(dep));
+     return to_return;
 }
 
-vector<string> DepSystem::get_symbols(function<bool(string,string,Symbol_State)> selector) const throw(const char*)
+vector<string> DepSystem::get_direct_dependencies(const string& symbol) const throw(const char*)
 {
-	 vector<string> to_return;
-	 unordered_set<string> considered_symbols;
-	 for(const Symbol& x : symbols)
-	 {
-		  vector<string> to_add = get_dependencies_recursive(x,considered_symbols);
-		  to_return.insert(to_return.end(),to_add.begin(),to_add.end());
-		  considered_symbols.insert(to_add.begin(),to_add.end());
-	 }
+     const Symbol& sym = find_symbol(symbol,"get_direct_dependencies() called with nonexistent sym name.");
 
-	 for(int i=0; i<to_return.size(); i++)
-	 {
-		  const Symbol& sym = *symbols.find(Symbol{to_return[i]});
-		  if(!selector(sym.name,sym.value,sym.state))
-		  {
-			   to_return.erase(to_return.begin()+i);
-			   i--;
-		  }
-	 }
+     vector<string> to_return = get_names(sym.dependency_edges);
+     for(const vector<Id>& dep_list : sym.dependency_list_list)
+          for(Id list_sym : dep_list)
+               if(exists(list_sym))
+               {
+                    to_return.push_back(names.get(list_sym));
+                    break;
+               }
 
-	 return to_return;
+     return to_return;
 }
 
-unordered_set<string> DepSystem::get_dependents_recursive(const string& symname) const throw(const char*)
+vector<string> DepSystem::get_direct_dependents(const string& symbol) const throw(const char*)
 {
-	 unordered_set<string> to_return;
+     const Symbol& sym = find_symbol(symbol,"get_direct_dependents() called with nonexistent sym name.");
 
-	 //Add ourselves to to_return and to the considered_symbols set.
-	 to_return.insert(symname);
+     vector<string> to_return = get_names(sym.reverse_dependency_edges);
+     for(Id list_owner : sym.reverse_dependency_list_set)
+          to_return.push_back(names.get(list_owner));
+     return to_return;
+}
 
-	 //Get symbol for this name
-	 Symbol symbol = *symbols.find(Symbol{symname});
+vector<string> DepSystem::get_symbols(function<bool(string,string,Symbol_State)> selector) const throw(const char*)
+{
+	 update_build_order();
 
-	 //Deal with reverse dependencies
-	 for(const string& revdep : symbol.reverse_dependency_edges)
+	 vector<string> to_return;
+	 for(Id id : build_order)
 	 {
-		  unordered_set<string> revdep_revdeps = get_dependents_recursive(revdep);
-		  to_return.insert(revdep_revdeps.begin(),revdep_revdeps.end());
+		  if(id==NO_SYMBOL) //hole left by a deleted symbol
+			   continue;
+		  const Symbol& sym = symbols[id];
+		  string name = names.get(id);
+		  if(selector(name,sym.value,sym.state))
+			   to_return.push_back(std::move(name));
 	 }
 
-	 //Deal with reverse dependency list set
-	 for(const string& revdep : symbol.reverse_dependency_list_set)
+	 return to_return;
+}
+
+vector<DepSystem::Id> DepSystem::get_dependents_recursive(Id symbol) const
+{
+	 //Start with ourselves
+	 vector<Id> to_return{symbol};
+	 unordered_set<Id> visited{symbol};
+
+	 //Walk reverse dependencies and reverse dependency list sets, visiting each symbol once
+	 for(size_t i=0; i<to_return.size(); i++)
 	 {
-		  unordered_set<string> revdep_revdeps = get_dependents_recursive(revdep);
-		  to_return.insert(revdep_revdeps.begin(),revdep_revdeps.end());
+		  const Symbol& current = symbols[to_return[i]];
+		  for(const vector<Id>* revdeps : {&current.reverse_dependency_edges,&current.reverse_dependency_list_set})
+			   for(Id revdep : *revdeps)
+					if(visited.insert(revdep).second)
+						 to_return.push_back(revdep);
 	 }
 
 	 return to_return;
@@ -511,119 +761,117 @@ unordered_set<string> DepSystem::get_dependents_recursive(const string& symname)
 
 vector<string> DepSystem::get_dependents(const string& symbol, function<bool(string,string,Symbol_State)> selector) const throw(const char*)
 {
-	 auto sym_ = symbols.find(Symbol{symbol});
-	 if(sym_==symbols.end())
-		  throw "get_dependents() called with nonexistent sym name.";
+	 Id id = find_symbol(symbol,"get_dependents() called with nonexistent sym name.").id;
+	 update_build_order();
 
-	 //Make recursive call
-	 unordered_set<string> dependents = get_dependents_recursive(symbol);
+	 //Get our dependents, leaving out ourselves per our API...
+	 vector<const Symbol*> dependents;
+	 for(Id dependent : get_dependents_recursive(id))
+		  if(dependent!=id)
+			   dependents.push_back(&symbols[dependent]);
 
-	 //We have the dependents now: we just need to put them in order.
+	 //...put them in build order, and apply the user-supplied selector.
+	 sort(dependents.begin(),dependents.end(),[](const Symbol* left, const Symbol* right) { return left->build_order_index < right->build_order_index; });
 
-	 //Construct to_return by getting build plan for each dependent and appending new values
 	 vector<string> to_return;
-	 for(const string& symname : dependents)
+	 for(const Symbol* x : dependents)
 	 {
-		  vector<string> build_plan = get_dependencies_recursive(Symbol{symname},{});
-
-		  for(const string& x : build_plan)
-			   //This is a linear search.  If it ever gets too slow, just make a parallel unordered_map.
-			   if(find(to_return.begin(),to_return.end(),x)==to_return.end())
-					to_return.push_back(x);
-	 }
-
-	 //Per our API, delete ourselves from the dependency list
-	 to_return.erase(find(to_return.begin(),to_return.end(),symbol));
-
-	 //Now, we have all our dependents in the right order in to_return.
-	 //The problem is there's a lot of junk in-between them.
-	 //We deal with this by deleting the junk while simultaneously applying the user-supplied selector.
-	 for(int i=0; i<to_return.size(); i++)
-	 {
-		  const Symbol& revdeplist_sym = *symbols.find(Symbol{to_return[i]});
-		  if(!dependents.count(to_return[i]) || !selector(revdeplist_sym.name,revdeplist_sym.value,revdeplist_sym.state))
-		  {
-			   to_return.erase(to_return.begin()+i);
-			   i--;
-		  }
+		  string name = names.get(x->id);
+		  if(selector(name,x->value,x->state))
+			   to_return.push_back(std::move(name));
 	 }
 
 	 return to_return;
 }
 
-vector<string> DepSystem::get_build_plan(const string& symbol) const throw(const char*)
+vector<DepSystem::Id> DepSystem::get_build_plan(const Symbol& symbol) const throw(const char*)
 {
-	 auto sym_ = symbols.find(Symbol{symbol});
-	 if(sym_==symbols.end())
-		  throw "get_build_plan() called with nonexistent sym name.";
-
-	 vector<string> all_dependencies = get_dependencies_recursive(*sym_,{});
+	 vector<Id> all_dependencies = get_dependencies_recursive(symbol);
 
 	 //DO _NOT_ INCLUDE DISABLED SYMBOLS HERE!
 	 //It is PERFECTLY OKAY to build a symbol with a disabled symbol in its build plan!
 	 //"DISABLED" means "valid, but unable to be regenerated from its dependencies."
-	 vector<string> unbuildable_dependencies = select_syms_with_states(all_dependencies,{INVALID});
-
-	 if(unbuildable_dependencies.size())
+	 if(any_of(all_dependencies.begin(),all_dependencies.end(),[&](Id x) { return symbols[x].state==INVALID; }))
 		  throw "get_build_plan() called with unbuildable symbol.";
 
-	 return select_syms_with_states(all_dependencies,{NONBUILT,STALE});
+	 vector<Id> to_return;
+	 for(Id x : all_dependencies)
+		  if(symbols[x].state==NONBUILT || symbols[x].state==STALE)
+			   to_return.push_back(x);
+	 return to_return;
+}
+
+vector<string> DepSystem::get_build_plan(const string& symbol) const throw(const char*)
+{
+	 return get_names(get_build_plan(find_symbol(symbol,"get_build_plan() called with nonexistent sym name.")));
 }
 
 void DepSystem::build_symbol(const string& symbol) throw(const char*)
 {
-	 vector<string> buildlist = get_build_plan(symbol);
+	 vector<Id> buildlist = get_build_plan(find_symbol(symbol,"get_build_plan() called with nonexistent sym name."));
 
-	 for(string x_ : buildlist)
+	 for(Id x_ : buildlist)
 	 {
-		  const Symbol& x = *symbols.find(Symbol{x_});
+		  Symbol& x = symbols[x_];
 		  if(x.callback)
-			   x.callback(x.name,x.value);
-          set_state(x.name,VALID);
+			   x.callback(names.get(x_),x.value);
+		  x.state = VALID;
 	 }
 }
 
+void DepSystem::build_single_symbol(const string& symbol) throw(const char*)
+{
+     Symbol& sym = find_symbol(symbol,"build_single_symbol() called with nonexistent sym name.");
+
+     if(sym.callback)
+          sym.callback(symbol,sym.value);
+     sym.state = VALID;
+}
+
 void DepSystem::invalidate_dependents(const string& symbol) throw(const char*)
 {
-	 get_dependents(symbol, [&](string symname, string symval_ignored, Symbol_State symstate)
-					{
-						 Symbol sym = *symbols.find(Symbol{symname});
-						 bool symchanged = false;
-						 switch(symstate)
-						 {
-						 case DISABLED:
-							  sym.state = INVALID;
-							  symchanged = true;
-							  break;
-
-						 case VALID:
-							  sym.state = STALE;
-							  symchanged = true;
-							  break;
-						 }
-
-						 if(symchanged)
-						 {
-							  symbols.erase(sym);
-							  symbols.insert(sym);
-						 }
-
-						 return false;
-					}
-		  );
+	 invalidate_dependents_of(find_symbol(symbol,"invalidate_dependents() called with nonexistent sym name.").id);
+}
+
+void DepSystem::invalidate_dependents_of(Id symbol)
+{
+     //Order doesn't matter here, so there's no need to sort the dependents into a build order.
+     for(Id dependent : get_dependents_recursive(symbol))
+     {
+          if(dependent==symbol)
+               continue;
+
+          Symbol& sym = symbols[dependent];
+          switch(sym.state)
+          {
+          case DISABLED:
+               sym.state = INVALID;
+               break;
+
+          case VALID:
+               sym.state = STALE;
+               break;
+          }
+     }
+}
+
+FrozenDepSystem DepSystem::freeze() const
+{
+     return FrozenDepSystem(*this);
 }
 
 ostream& operator<<(ostream& sout, const DepSystem& x)
 {
 	 for(const DepSystem::Symbol& sym : x.symbols)
-		  sout << sym;
+		  if(sym.exists)
+			   x.write_symbol(sout,sym);
 	 sout << "%%%ENDSYMBOLS%%%\n";
 
 	 for(const auto& shadow_pair : x.shadowers)
 	 {
-		  sout << shadow_pair.first << endl;
+		  sout << x.names.c_str(shadow_pair.first) << endl;
 		  sout << "%%%ENDSHADOWER%%%\n";
-		  sout << shadow_pair.second << endl;
+		  sout << x.names.c_str(shadow_pair.second) << endl;
 		  sout << "%%%ENDSHADOWEE%%%\n";
 	 }
 	 sout << "%%%ENDSHADOWERS%%%\n";
@@ -633,12 +881,11 @@ ostream& operator<<(ostream& sout, const DepSystem& x)
 
 istream& operator>>(istream& sin, DepSystem& x)
 {
+	 x.build_order_valid = false;
+	 x.closure_cache.clear();
+
 	 while(peekline(sin)!="%%%ENDSYMBOLS%%%")
-	 {
-		  DepSystem::Symbol to_insert;
-		  sin >> to_insert;
-		  x.symbols.insert(to_insert);
-	 }
+		  x.read_symbol(sin);
 
 	 string shadower,shadowee;
 	 getline(sin,shadower); //swallow "%%%ENDSYMBOLS%%%"
@@ -660,15 +907,15 @@ istream& operator>>(istream& sin, DepSystem& x)
 			   shadowee = shadowee + "\n" + temp;
 			   getline(sin,temp);
 		  }
-		  
-		  x.shadowers.emplace(shadower,shadowee);
+
+		  x.shadowers.emplace(x.names.intern(shadower),x.names.intern(shadowee));
 		  getline(sin,shadower);
 	 }
 
 	 return sin;
 }
 
-ostream& operator<<(ostream& sout, const DepSystem::Symbol& x)
+void DepSystem::write_symbol(ostream& sout, const Symbol& x) const
 {
 	 auto output_sym = [&sout](const string& field, const char* terminus)
 		  {
@@ -676,37 +923,36 @@ ostream& operator<<(ostream& sout, const DepSystem::Symbol& x)
 			   sout << terminus << endl;
 		  };
 
-	 output_sym(x.name,"%%%ENDSYMNAME%%%");
+	 output_sym(names.get(x.id),"%%%ENDSYMNAME%%%");
 	 output_sym(x.value,"%%%ENDSYMVALUE%%%");
 	 output_sym(to_string(x.state),"%%%ENDSYMSTATE%%%");
 
 	 //NOTE: Callbacks are *NOT* serialized for obvious reasons.
-			   
-	 for(const string& edge : x.dependency_edges)
-		  output_sym(edge,"%%%ENDDEPEDGE%%%");
+
+	 for(Id edge : x.dependency_edges)
+		  output_sym(names.get(edge),"%%%ENDDEPEDGE%%%");
 	 sout << "%%%ENDDEPEDGES%%%\n";
 
-	 for(const string& edge : x.reverse_dependency_edges)
-		  output_sym(edge,"%%%ENDREVDEPEDGE%%%");
+	 for(Id edge : x.reverse_dependency_edges)
+		  output_sym(names.get(edge),"%%%ENDREVDEPEDGE%%%");
 	 sout << "%%%ENDREVDEPEDGES%%%\n";
 
-	 for(const vector<string>& deplist : x.dependency_list_list)
+	 for(const vector<Id>& deplist : x.dependency_list_list)
 	 {
-		  for(const string& depname : deplist)
-			   output_sym(depname,"%%%ENDDEPLISTITEM%%%");
+		  for(Id depname : deplist)
+			   output_sym(names.get(depname),"%%%ENDDEPLISTITEM%%%");
 		  sout << "%%%ENDDEPLIST%%%\n";
 	 }
 	 sout << "%%%ENDDEPLISTLIST%%%\n";
 
-	 for(const string& revdep : x.reverse_dependency_list_set)
-		  output_sym(revdep,"%%%ENDREVDEP%%%");
+	 for(Id revdep : x.reverse_dependency_list_set)
+		  output_sym(names.get(revdep),"%%%ENDREVDEP%%%");
 	 sout << "%%%ENDREVDEPLIST%%%\n";
 
 	 sout << "%%%ENDSYMBOL%%%\n";
-	 return sout;
 }
 
-istream& operator>>(istream& sin, DepSystem::Symbol& x)
+void DepSystem::read_symbol(istream& sin)
 {
 	 auto getsym = [&sin](const char* terminus)
 		  {
@@ -722,20 +968,26 @@ istream& operator>>(istream& sin, DepSystem::Symbol& x)
 			   return to_return;
 		  };
 
-	 auto getsymlist = [&sin,&getsym](unordered_set<string>& target, const char* item_terminus, const char* list_terminus)
+	 auto getsymlist = [&](vector<Id>& target, const char* item_terminus, const char* list_terminus)
 		  {
 			   string temp;
 			   getline(sin,temp);
 			   while(temp!=list_terminus)
 			   {
 					temp += getsym(item_terminus);
-					target.insert(temp);
+					target.push_back(names.intern(temp));
 					getline(sin,temp);
 			   }
 		  };
 
 
-	 x.name = getsym("%%%ENDSYMNAME%%%");
+	 Id id = names.intern(getsym("%%%ENDSYMNAME%%%"));
+	 if(symbols.size()<=id)
+		  symbols.resize(id+1);
+	 Symbol& x = symbols[id];
+	 x = Symbol();
+	 x.id = id;
+	 x.exists = true;
 	 x.value = getsym("%%%ENDSYMVALUE%%%");
 	 x.state = static_cast<DepSystem::Symbol_State>(stoi(getsym("%%%ENDSYMSTATE%%%")));
 
@@ -746,7 +998,7 @@ istream& operator>>(istream& sin, DepSystem::Symbol& x)
 	 vector<string> lines;
 	 StringFunctions::tokenize(lines,temp,"\n");
 	 temp.clear();
-	 vector<string> to_push;
+	 vector<Id> to_push;
 	 for(string item : lines)
 		  if(item=="%%%ENDDEPLIST%%%")
 		  {
@@ -755,7 +1007,7 @@ istream& operator>>(istream& sin, DepSystem::Symbol& x)
 		  }
 		  else if(item=="%%%ENDDEPLISTITEM%%%")
 		  {
-			   to_push.push_back(temp);
+			   to_push.push_back(names.intern(temp));
 			   temp.clear();
 		  }
 		  else
@@ -764,5 +1016,4 @@ istream& operator>>(istream& sin, DepSystem::Symbol& x)
 	 getsymlist(x.reverse_dependency_list_set,"%%%ENDREVDEP%%%","%%%ENDREVDEPLIST%%%");
 
 	 getline(sin,temp); //Swallow "%%%ENDSYMBOL%%%\n"
-	 return sin;
 }
@@ -1,6 +1,7 @@
 #ifndef DEPLIB_HPP
 #define DEPLIB_HPP
 
+#include <deque>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
@@ -11,7 +12,10 @@
 #include <vector>
 
 #include "StringFunctions.h"
+#include "bake_stats.hpp"
+#include "string_interner.hpp"
 
+using std::deque;
 using std::function;
 using std::getline;
 using std::initializer_list;
@@ -26,10 +30,14 @@ using std::unordered_multimap;
 using std::unordered_set;
 using std::vector;
 
+class FrozenDepSystem;
+
 class DepSystem
 {
 	 friend ostream& operator<<(ostream& sout, const DepSystem& x);
 	 friend istream& operator>>(istream& sin, DepSystem& x);
+	 friend class DepSnapshot;
+	 friend class FrozenDepSystem;
 public:
 	 //NOTE: "VALID" must always be the last state!
 	 enum Symbol_State { NONBUILT, DISABLED, STALE, INVALID /*conceptually the same as STALE+DISABLED*/, VALID };
@@ -61,13 +69,14 @@ public:
 	 //Sets state of symbol.  This does NO PROCESSING of any dependencies of the modified symbol!  Throws exception on nonexistent symbol name.
 	 void set_state(const string& symbol_name, Symbol_State new_state) throw(const char*);
 
-	 //Returns all syms in passed vector which are of the given states
-	 vector<string> select_syms_with_states(const vector<string>& symlist, const initializer_list<Symbol_State>& states) const;
+	 //Returns all syms in passed vector which are of the given states.  Throws exception if any of them is nonexistent.
+	 vector<string> select_syms_with_states(const vector<string>& symlist, const initializer_list<Symbol_State>& states) const throw(const char*);
 
 	 //Sets callback for symbol
 	 void set_callback(const string& symbol_name, function<void(string,string)> callback);
 
 	 //Adds or sets dependency between symbols.  Throws exception -- and does not add dependency -- if added dependency would make dependency graph cyclic.
+	 //During a batch, only a symbol depending on itself is caught here; other cycles are caught by commit_batch().
 	 void add_dependency(const string& from_symbol, const string& to_symbol) throw(const char*);
 
 	 //Returns whether dependency exists from symbol from to symbol to.
@@ -83,7 +92,7 @@ public:
      //This code is NOT to handle the local-global symbol merging that can occur in SEPM.
      //That is an application-specific problem.  However, functions to make that code simpler should exist.
 
-	 //Adds dependency list to symbol.  Throws exception if this would make graph cyclic.
+	 //Adds dependency list to symbol.  Throws exception if this would make graph cyclic (during a batch, commit_batch() does instead).
 	 void add_dependency_list(const vector<string>& deplist, const string& to_symbol) throw(const char*);
 
 	 //Gets dependency lists of symbol.  Throws if symbol does not exist.
@@ -98,6 +107,12 @@ public:
      //Returns the direct dependency edges of the given symbol in an arbitrary order.  Does not handle dependency lists.
      unordered_set<string> get_dependency_edges(const string& symbol) const;
 
+	 //Returns the direct dependencies of the given symbol in an arbitrary order, including the symbols currently satisfying its dependency lists.  Throws exception for nonexistent symbols.
+	 vector<string> get_direct_dependencies(const string& symbol) const throw(const char*);
+
+     //Returns the symbols directly depending on the given symbol in an arbitrary order, including any with a dependency list it appears in.  Throws exception for nonexistent symbols.
+     vector<string> get_direct_dependents(const string& symbol) const throw(const char*);
+
 	 //In what would be a buildable order if all root dependencies were valid and all nonroot dependencies were nonbuilt, return a vector of all symbols.
 	 vector<string> get_symbols(function<bool(string,string,Symbol_State)> selector = [](string symbol, string value, Symbol_State state) noexcept { return true; }) const throw(const char*);
 
@@ -107,61 +122,135 @@ public:
 	 //Returns stale symbols on which passed symbol depends in a buildable order, including this symbol itself.  Throws exception if symbol nonexistent or if no way to build symbol.
      vector<string> get_build_plan(const string& symbol) const throw(const char*);
 
+	 /*Batches are for adding many symbols and edges at once, such as when reading a Bakefile.
+	   During a batch, edges are added without checking them for cycles or keeping the build order up to date.
+	   commit_batch() then checks the whole graph in one O(V+E) pass, which also computes the new build order.
+	   Queries other than has_symbol(), get_value(), get_state(), and has_dependency() should wait until the batch is over, as should copying the DepSystem.*/
+	 //Starts a batch.  Throws exception if one is already in progress.
+	 void begin_batch() throw(const char*);
+
+	 //Ends the batch.  If the graph is now cyclic, undoes the batch as abort_batch() does, and throws exception listing every cycle found.
+	 void commit_batch() throw(const char*);
+
+	 //Ends the batch, removing the symbols, edges, and dependency lists it added.  Changes to values and states, and deletions, are not undone.
+	 void abort_batch();
+
 	 //Invokes dependency build functions on all stale or nonbuilt dependencies of symbol in buildable order and marks affected symbols valid.
 	 void build_symbol(const string& symbol) throw(const char*);
 
+	 //Invokes the build function of this symbol alone and marks it valid.  Dependencies are not examined: the caller must already have built them.  Throws exception for nonexistent symbols.
+	 void build_single_symbol(const string& symbol) throw(const char*);
+
 	 //Marks all valid symbols which depend on this symbol as stale (and all disabled symbols invalid).  Throws exception for nonexistent symbols.
 	 void invalidate_dependents(const string& symbol) throw(const char*);
 
+	 //Returns the graph's structure and states as they are now, in a form for building it (see frozen_depsystem.hpp).  Must not be called during a batch.
+	 FrozenDepSystem freeze() const;
+
 private:
+	 //Symbols and the edges between them refer to each other by the ID of their name in names.
+	 typedef StringInterner::Id Id;
+	 static const Id NO_SYMBOL = StringInterner::NOT_FOUND;
+
 	 //Internal symbol structure
 	 struct Symbol
 	 {
-		  string name;
+		  Id id;
+		  bool exists = false; //false for names we only know from dependency lists, and for deleted symbols
 		  string value;
 		  Symbol_State state;
 		  function<void(string,string)> callback;
-		  unordered_set<string> dependency_edges;
-		  unordered_set<string> reverse_dependency_edges;
-		  vector<vector<string>> dependency_list_list;
-		  unordered_set<string> reverse_dependency_list_set;
-	 };
-	 friend ostream& operator<<(ostream& sout, const DepSystem::Symbol& x);
-	 friend istream& operator>>(istream& sin, DepSystem::Symbol& x);
 
-	 //Symbol Hash
-	 class Symbol_hash
-	 {
-	 public:
-		  size_t operator()(const Symbol& symbol) const { return std::hash<string>()(symbol.name); }
-	 };
+		  //Edges are unordered, and each appears once.
+		  vector<Id> dependency_edges;
+		  vector<Id> reverse_dependency_edges;
+		  vector<vector<Id>> dependency_list_list;
+		  vector<Id> reverse_dependency_list_set;
 
-	 //Symbol Comparator
-	 class Symbol_equivalence
-	 {
-	 public:
-		  bool operator()(const Symbol& left, const Symbol& right) const { return left.name == right.name; }
-	 };
+		  //Position of this symbol in build_order; only meaningful while build_order_valid
+		  mutable size_t build_order_index;
 
+		  //Used by update_build_order() to find cycles
+		  mutable size_t lowlink;
+
+		  BAKE_COUNT_COPIES(SYMBOL_COPIES)
+	 };
 
 	 //Private helper functions
-	 vector<string> get_dependencies_recursive(const Symbol& symbol, unordered_set<string> considered_symbols) const throw(const char*);
+	 Id find_id(const string& name) const noexcept; //NO_SYMBOL if there's no such symbol
+	 bool exists(Id id) const noexcept { return id<symbols.size() && symbols[id].exists; }
+	 Symbol& find_symbol(const string& name, const char* error) throw(const char*);
+	 const Symbol& find_symbol(const string& name, const char* error) const throw(const char*);
 
-	 unordered_set<string> get_dependents_recursive(const string& symbol) const throw(const char*);
+	 //Returns whether from has a dependency edge to to, searching whichever of the two has fewer edges.
+	 bool edge_exists(const Symbol& from, const Symbol& to) const;
 
-     bool detect_cycle(const string& detect_from, const string& cycle_member) const;
+	 //Returns whether symbol is what satisfies any of owner's dependency lists, and so belongs in its reverse_dependency_list_set.
+	 bool satisfies_list_of(Id symbol, const Symbol& owner) const;
 
-	 //Set of all Symbols
-	 unordered_set<Symbol,Symbol_hash,Symbol_equivalence> symbols;
+	 //Returns the names of ids.
+	 vector<string> get_names(const vector<Id>& ids) const;
+
+	 //Calls f with each direct dependency of symbol, including those via dependency lists
+	 template<typename F> void for_each_dependency(const Symbol& symbol, F f) const;
+
+	 //Returns symbol and everything it depends on, in buildable order.  Memoized in closure_cache.
+	 vector<Id> get_dependencies_recursive(const Symbol& symbol) const throw(const char*);
+
+	 //Returns symbol and everything depending on it, in no particular order.
+	 vector<Id> get_dependents_recursive(Id symbol) const;
+
+	 //As get_build_plan()
+	 vector<Id> get_build_plan(const Symbol& symbol) const throw(const char*);
+
+	 //As invalidate_dependents()
+	 void invalidate_dependents_of(Id symbol);
+
+	 //Recomputes build_order from scratch if it is not valid.
+	 //Returns the cycles found, as the list of symbols making up each one; if there are any, build_order is left invalid.
+	 vector<vector<string>> update_build_order() const;
+
+	 /*Moves symbols around in build_order so that dependency comes before dependent, as needed for an edge between them.
+	   Returns false, leaving build_order alone, if dependency already depends on dependent: that is, if the edge would create a cycle.
+	   This is the Pearce-Kelly algorithm: only symbols ordered between the two are examined.*/
+	 bool order_dependency(const Symbol& dependency, const Symbol& dependent) const;
+
+	 //Collects dependent and those of its dependents ordered before upper_bound into affected.  Returns true if it finds the symbol at upper_bound, which means a cycle.
+	 bool detect_cycle(const Symbol& dependent, size_t upper_bound, vector<const Symbol*>& affected) const;
+
+	 //Must be called whenever the direct dependencies of symbol change, before they change: drops the cached results the change affects.
+	 void dependencies_changing(Id symbol);
+
+	 //Serialization of a single symbol, for operator<< and operator>>
+	 void write_symbol(ostream& sout, const Symbol& x) const;
+	 void read_symbol(istream& sin);
+
+	 //Every name we've seen, each stored once, so that edges can be IDs rather than copies of names.  Clearing the graph frees them all at once.
+	 StringInterner names;
+
+	 //All Symbols, indexed by ID; a deque, so adding symbols leaves references to the others valid.
+	 deque<Symbol> symbols;
 
 	 //Set of nonexistent symbols which may shadow other symbols
-	 unordered_multimap<string,string> shadowers;
+	 unordered_multimap<Id,Id> shadowers;
+
+	 /*All symbols in a buildable order.  get_symbols() returns it directly, and other buildable orders are obtained by sorting on it.
+	   It is kept up to date as edges are added, and only computed from scratch (in O(V+E)) after deserialization or when too many symbols have been deleted.
+	   Deleted symbols leave behind NO_SYMBOL.*/
+	 mutable vector<Id> build_order;
+	 mutable size_t build_order_holes = 0;
+	 mutable bool build_order_valid = true;
+
+	 //Results of get_dependencies_recursive.  A symbol's entry is dropped when its dependencies, or those of anything it depends on, change.
+	 mutable unordered_map<Id,vector<Id>> closure_cache;
+
+	 //Whether we're in a batch, and how to undo each addition it made, in the order they were made
+	 bool batching = false;
+	 vector<function<void()>> batch_undo;
 };
 
 //I/O functions
 ostream& operator<<(ostream& sout, const DepSystem& x);
 istream& operator>>(istream& sin, DepSystem& x);
-ostream& operator<<(ostream& sout, const DepSystem::Symbol& x);
-istream& operator>>(istream& sin, DepSystem::Symbol& x);
 
 #endif
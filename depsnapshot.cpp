@@ -0,0 +1,361 @@
+#include "depsnapshot.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::any_of;
+using std::find;
+using std::lower_bound;
+using std::make_pair;
+using std::ofstream;
+using std::rename;
+using std::sort;
+
+static const char SNAPSHOT_MAGIC[8] = {'B','A','K','E','S','N','A','P'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+const DepSnapshot::Index DepSnapshot::NOT_FOUND;
+
+struct DepSnapshot::Header
+{
+     char magic[8];
+     uint32_t version;
+     uint32_t symbol_count;
+     uint32_t dependency_count;
+     uint32_t list_count;
+     uint32_t list_member_count;
+     uint32_t string_count;
+     uint64_t string_bytes;
+     uint64_t tag;
+};
+
+/*Symbol records are followed by one extra record holding the ends of the last symbol's ranges.
+  Symbol i's name is string i; its direct dependencies are dependencies[dependencies_begin,next dependencies_begin),
+  of which those before edges_end are dependency edges and the rest satisfy its dependency lists;
+  and its dependency lists are list_offsets[lists_begin,next lists_begin).*/
+struct DepSnapshot::Symbol_Record
+{
+     uint32_t value;
+     uint32_t state;
+     uint32_t dependencies_begin;
+     uint32_t edges_end;
+     uint32_t lists_begin;
+     uint32_t marked;
+};
+
+//The layout of a snapshot, in order:
+//  Header
+//  uint64_t string_offsets[string_count+1]: string i is strings[string_offsets[i],string_offsets[i+1]), including its terminating NUL
+//  Symbol_Record symbol_records[symbol_count+1]
+//  Index dependencies[dependency_count]: symbol indices
+//  Index list_offsets[list_count+1]: list i is list_members[list_offsets[i],list_offsets[i+1])
+//  Index list_members[list_member_count]: string IDs, since list members need not exist
+//  Index sorted_symbols[symbol_count]: symbol indices, sorted by name
+//  char strings[string_bytes]
+//Everything is a multiple of 4 bytes long except the strings, which come last, so every array is aligned.
+
+template<typename T> static void append(string& buffer, const T* data, size_t count)
+{
+     buffer.append(reinterpret_cast<const char*>(data),count*sizeof(T));
+}
+
+bool DepSnapshot::save(const DepSystem& to_save, const string& path, uint64_t tag, const unordered_set<string>& marked) throw(const char*)
+{
+     //Symbols take the first string IDs, in build order; values and missing dependency list members follow.
+     to_save.update_build_order();
+     vector<const DepSystem::Symbol*> symbols;
+     symbols.reserve(to_save.build_order.size());
+     for(DepSystem::Id id : to_save.build_order)
+          if(id!=DepSystem::NO_SYMBOL) //hole left by a deleted symbol
+               symbols.push_back(&to_save.symbols[id]);
+     vector<pair<const char*,size_t>> string_table;
+     unordered_map<string,uint32_t> string_ids;
+     vector<Index> positions(to_save.build_order.size()); //our indices, which leave out the holes in build_order
+     for(const DepSystem::Symbol* x : symbols)
+     {
+          positions[x->build_order_index] = string_table.size();
+          string_table.push_back(make_pair(to_save.names.c_str(x->id),to_save.names.size(x->id)));
+     }
+     auto intern = [&](const string& value)
+          {
+               DepSystem::Id existing = to_save.names.find(value);
+               if(to_save.exists(existing))
+                    return positions[to_save.symbols[existing].build_order_index];
+               auto added = string_ids.emplace(value,string_table.size());
+               if(added.second)
+                    string_table.push_back(make_pair(added.first->first.c_str(),added.first->first.size()));
+               return added.first->second;
+          };
+     auto intern_name = [&](DepSystem::Id name)
+          {
+               if(to_save.exists(name))
+                    return positions[to_save.symbols[name].build_order_index];
+               return intern(to_save.names.get(name));
+          };
+
+     vector<Symbol_Record> symbol_records;
+     vector<Index> dependencies;
+     vector<Index> list_offsets;
+     vector<Index> list_members;
+     for(const DepSystem::Symbol* x : symbols)
+     {
+          Symbol_Record record;
+          record.value = intern(x->value);
+          record.state = x->state;
+          record.marked = marked.size() && marked.count(to_save.names.get(x->id));
+          record.dependencies_begin = dependencies.size();
+          for(DepSystem::Id dep : x->dependency_edges)
+               dependencies.push_back(positions[to_save.symbols[dep].build_order_index]);
+          record.edges_end = dependencies.size();
+          record.lists_begin = list_offsets.size();
+          for(const vector<DepSystem::Id>& deplist : x->dependency_list_list)
+          {
+               list_offsets.push_back(list_members.size());
+               bool satisfied = false;
+               for(DepSystem::Id member : deplist)
+               {
+                    Index member_id = intern_name(member);
+                    list_members.push_back(member_id);
+                    if(!satisfied && member_id<symbols.size())
+                    {
+                         dependencies.push_back(member_id);
+                         satisfied = true;
+                    }
+               }
+          }
+          symbol_records.push_back(record);
+     }
+     Symbol_Record end_record = {0,0,(uint32_t)dependencies.size(),(uint32_t)dependencies.size(),(uint32_t)list_offsets.size(),0};
+     symbol_records.push_back(end_record);
+     list_offsets.push_back(list_members.size());
+
+     vector<Index> sorted_symbols(symbols.size());
+     for(Index i=0; i<sorted_symbols.size(); i++)
+          sorted_symbols[i] = i;
+     sort(sorted_symbols.begin(),sorted_symbols.end(),[&](Index left, Index right) { return strcmp(string_table[left].first,string_table[right].first)<0; });
+
+     vector<uint64_t> string_offsets{0};
+     for(const pair<const char*,size_t>& x : string_table)
+          string_offsets.push_back(string_offsets.back()+x.second+1);
+
+     Header header;
+     static_assert(sizeof(header)%sizeof(uint64_t)==0,"string_offsets must follow the header aligned");
+     memcpy(header.magic,SNAPSHOT_MAGIC,sizeof(header.magic));
+     header.version = SNAPSHOT_VERSION;
+     header.symbol_count = symbols.size();
+     header.dependency_count = dependencies.size();
+     header.list_count = list_offsets.size()-1;
+     header.list_member_count = list_members.size();
+     header.string_count = string_table.size();
+     header.string_bytes = string_offsets.back();
+     header.tag = tag;
+
+     string buffer;
+     buffer.reserve(sizeof(header)+string_offsets.size()*sizeof(uint64_t)+symbol_records.size()*sizeof(Symbol_Record)+
+                    (dependencies.size()+list_offsets.size()+list_members.size()+sorted_symbols.size())*sizeof(Index)+header.string_bytes);
+     append(buffer,&header,1);
+     append(buffer,string_offsets.data(),string_offsets.size());
+     append(buffer,symbol_records.data(),symbol_records.size());
+     append(buffer,dependencies.data(),dependencies.size());
+     append(buffer,list_offsets.data(),list_offsets.size());
+     append(buffer,list_members.data(),list_members.size());
+     append(buffer,sorted_symbols.data(),sorted_symbols.size());
+     for(const pair<const char*,size_t>& x : string_table)
+          buffer.append(x.first,x.second+1);
+
+     string temp_path = path+".tmp";
+     ofstream fout(temp_path,std::ios::binary);
+     fout.write(buffer.data(),buffer.size());
+     fout.close();
+     if(!fout.good())
+          return false;
+     return rename(temp_path.c_str(),path.c_str())==0;
+}
+
+DepSnapshot::DepSnapshot(const string& path) throw(const char*)
+{
+     int fd = open(path.c_str(),O_RDONLY|O_CLOEXEC);
+     if(fd==-1)
+          throw "Unable to open snapshot.";
+     struct stat statbuf;
+     if(fstat(fd,&statbuf)==-1 || statbuf.st_size < (off_t)sizeof(Header))
+     {
+          close(fd);
+          throw "Snapshot is truncated.";
+     }
+     mapping_size = statbuf.st_size;
+     mapping = mmap(NULL,mapping_size,PROT_READ,MAP_PRIVATE,fd,0);
+     close(fd);
+     if(mapping==MAP_FAILED)
+          throw "Unable to map snapshot.";
+
+     //Find the arrays, checking that the file is as big as the header says.
+     const char* position = static_cast<const char*>(mapping);
+     header = reinterpret_cast<const Header*>(position);
+     auto fail = [&](const char* error)
+          {
+               munmap(mapping,mapping_size);
+               throw error;
+          };
+     if(memcmp(header->magic,SNAPSHOT_MAGIC,sizeof(header->magic)))
+          fail("File is not a bake snapshot.");
+     if(header->version!=SNAPSHOT_VERSION)
+          fail("Snapshot is from an incompatible version of bake.");
+     uint64_t expected_size = sizeof(Header)+(header->string_count+1ull)*sizeof(uint64_t)+(header->symbol_count+1ull)*sizeof(Symbol_Record)+
+          (header->dependency_count+header->list_count+1ull+header->list_member_count+header->symbol_count)*sizeof(Index)+header->string_bytes;
+     if(expected_size!=mapping_size || header->symbol_count>header->string_count)
+          fail("Snapshot is truncated or corrupt.");
+     position += sizeof(Header);
+     string_offsets = reinterpret_cast<const uint64_t*>(position);
+     position += (header->string_count+1ull)*sizeof(uint64_t);
+     symbol_records = reinterpret_cast<const Symbol_Record*>(position);
+     position += (header->symbol_count+1ull)*sizeof(Symbol_Record);
+     dependencies = reinterpret_cast<const Index*>(position);
+     position += header->dependency_count*sizeof(Index);
+     list_offsets = reinterpret_cast<const Index*>(position);
+     position += (header->list_count+1ull)*sizeof(Index);
+     list_members = reinterpret_cast<const Index*>(position);
+     position += header->list_member_count*sizeof(Index);
+     sorted_symbols = reinterpret_cast<const Index*>(position);
+     position += header->symbol_count*sizeof(Index);
+     strings = position;
+
+     //Check every offset and index, so that none of our accessors can be led outside the mapping.
+     bool valid = string_offsets[0]==0 && string_offsets[header->string_count]==header->string_bytes;
+     for(Index i=0; valid && i<header->string_count; i++)
+          valid = string_offsets[i]<string_offsets[i+1] && string_offsets[i+1]<=header->string_bytes && !strings[string_offsets[i+1]-1];
+     const Symbol_Record& end_record = symbol_records[header->symbol_count];
+     valid = valid && end_record.dependencies_begin==header->dependency_count && end_record.lists_begin==header->list_count;
+     for(Index i=0; valid && i<header->symbol_count; i++)
+     {
+          const Symbol_Record& record = symbol_records[i];
+          const Symbol_Record& next = symbol_records[i+1];
+          valid = record.value<header->string_count && record.state<=DepSystem::VALID &&
+               record.marked<=1 && record.dependencies_begin<=record.edges_end && record.edges_end<=next.dependencies_begin && record.lists_begin<=next.lists_begin;
+          for(Index j=record.dependencies_begin; valid && j<next.dependencies_begin; j++)
+               valid = dependencies[j]<i; //dependencies come before their dependents
+     }
+     valid = valid && list_offsets[0]==0 && list_offsets[header->list_count]==header->list_member_count;
+     for(Index i=0; valid && i<header->list_count; i++)
+          valid = list_offsets[i]<=list_offsets[i+1];
+     for(Index i=0; valid && i<header->list_member_count; i++)
+          valid = list_members[i]<header->string_count;
+     for(Index i=0; valid && i<header->symbol_count; i++)
+          valid = sorted_symbols[i]<header->symbol_count;
+     if(!valid)
+          fail("Snapshot is truncated or corrupt.");
+}
+
+DepSnapshot::~DepSnapshot()
+{
+     munmap(mapping,mapping_size);
+}
+
+uint64_t DepSnapshot::get_tag() const
+{
+     return header->tag;
+}
+
+DepSnapshot::Index DepSnapshot::get_symbol_count() const
+{
+     return header->symbol_count;
+}
+
+DepSnapshot::Index DepSnapshot::find_symbol(const string& name) const
+{
+     const Index* end = sorted_symbols+header->symbol_count;
+     const Index* found = lower_bound(sorted_symbols,end,name,[this](Index symbol, const string& val) { return strcmp(get_name(symbol),val.c_str())<0; });
+     return found!=end && get_name(*found)==name ? *found : NOT_FOUND;
+}
+
+const char* DepSnapshot::get_string(Index string_id) const
+{
+     return strings+string_offsets[string_id];
+}
+
+const char* DepSnapshot::get_name(Index symbol) const
+{
+     return get_string(symbol);
+}
+
+const char* DepSnapshot::get_value(Index symbol) const
+{
+     return get_string(symbol_records[symbol].value);
+}
+
+DepSystem::Symbol_State DepSnapshot::get_state(Index symbol) const
+{
+     return static_cast<DepSystem::Symbol_State>(symbol_records[symbol].state);
+}
+
+bool DepSnapshot::is_marked(Index symbol) const
+{
+     return symbol_records[symbol].marked;
+}
+
+pair<const DepSnapshot::Index*,const DepSnapshot::Index*> DepSnapshot::get_direct_dependencies(Index symbol) const
+{
+     return make_pair(dependencies+symbol_records[symbol].dependencies_begin,dependencies+symbol_records[symbol+1].dependencies_begin);
+}
+
+void DepSnapshot::load_into(DepSystem& to_construct, unordered_set<string>* marked) const throw(const char*)
+{
+     if(any_of(to_construct.symbols.begin(),to_construct.symbols.end(),[](const DepSystem::Symbol& x) { return x.exists; }))
+          throw "load_into() called with nonempty DepSystem.";
+
+     //Build the symbols and their forward edges straight from the snapshot...
+     to_construct.build_order.resize(header->symbol_count);
+     vector<DepSystem::Id> ids(header->symbol_count);
+     for(Index i=0; i<header->symbol_count; i++)
+     {
+          const Symbol_Record& record = symbol_records[i];
+          DepSystem::Id id = ids[i] = to_construct.names.intern(get_name(i));
+          if(to_construct.symbols.size()<=id)
+               to_construct.symbols.resize(id+1);
+          DepSystem::Symbol& to_add = to_construct.symbols[id];
+          to_add.id = id;
+          to_add.exists = true;
+          to_add.value = get_value(i);
+          to_add.state = get_state(i);
+          if(marked && record.marked)
+               marked->insert(get_name(i));
+          for(Index j=record.dependencies_begin; j<record.edges_end; j++)
+               to_add.dependency_edges.push_back(ids[dependencies[j]]);
+          for(Index j=record.lists_begin; j<symbol_records[i+1].lists_begin; j++)
+          {
+               to_add.dependency_list_list.emplace_back();
+               for(Index k=list_offsets[j]; k<list_offsets[j+1]; k++)
+                    to_add.dependency_list_list.back().push_back(to_construct.names.intern(get_string(list_members[k])));
+          }
+
+          //...which are already in build order.
+          to_add.build_order_index = i;
+          to_construct.build_order[i] = id;
+     }
+
+     //Now derive the reverse edges and shadowers.
+     for(Index i=0; i<header->symbol_count; i++)
+     {
+          const Symbol_Record& record = symbol_records[i];
+          for(Index j=record.dependencies_begin; j<record.edges_end; j++)
+               to_construct.symbols[ids[dependencies[j]]].reverse_dependency_edges.push_back(ids[i]);
+          for(Index j=record.lists_begin; j<symbol_records[i+1].lists_begin; j++)
+               for(Index k=list_offsets[j]; k<list_offsets[j+1]; k++)
+                    if(list_members[k]<header->symbol_count)
+                    {
+                         vector<DepSystem::Id>& satisfied = to_construct.symbols[ids[list_members[k]]].reverse_dependency_list_set;
+                         if(find(satisfied.begin(),satisfied.end(),ids[i])==satisfied.end())
+                              satisfied.push_back(ids[i]);
+                         break;
+                    }
+                    else
+                         to_construct.shadowers.emplace(to_construct.names.intern(get_string(list_members[k])),ids[i]);
+     }
+     to_construct.build_order_holes = 0;
+     to_construct.build_order_valid = true;
+}
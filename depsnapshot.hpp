@@ -0,0 +1,76 @@
+#ifndef DEPSNAPSHOT_HPP
+#define DEPSNAPSHOT_HPP
+
+#include "deplib.hpp"
+#include <cstdint>
+#include <utility>
+
+using std::pair;
+
+/*Binary snapshot of a DepSystem, for keeping a graph between runs or handing it to another process.
+  A snapshot is a header followed by flat arrays: a table of every string in the graph, each stored once,
+  and, for each symbol, ranges into shared arrays of dependency and dependency list entries.
+  Symbols are stored in buildable order and referred to by their position in it, so a symbol's dependencies always have smaller indices than it does.
+  The snapshot is mmap()ed and queried in place: opening one checks its bounds but builds no data structures.
+  Snapshots are in native byte order, so they are only meant for the kind of machine that wrote them.
+  A snapshot also holds a tag, which its writer can use to tell which graph it holds, and a mark for each symbol, for the writer's own use.*/
+class DepSnapshot
+{
+public:
+     //Index of a symbol in the snapshot
+     typedef uint32_t Index;
+     static const Index NOT_FOUND = -1;
+
+     //Writes to_save to path as a snapshot with the passed tag, marking the symbols in marked, and replacing any file there atomically.  Returns whether the snapshot could be written.
+     static bool save(const DepSystem& to_save, const string& path, uint64_t tag = 0, const unordered_set<string>& marked = unordered_set<string>()) throw(const char*);
+
+     //Maps the snapshot at path.  Throws exception if it can't be read or isn't a snapshot this version of bake understands.
+     explicit DepSnapshot(const string& path) throw(const char*);
+     ~DepSnapshot();
+     DepSnapshot(const DepSnapshot&) = delete;
+     DepSnapshot& operator=(const DepSnapshot&) = delete;
+
+     //Returns the tag the snapshot was saved with.
+     uint64_t get_tag() const;
+
+     //Returns the number of symbols in the snapshot.
+     Index get_symbol_count() const;
+
+     //Returns index of the symbol with the passed name, or NOT_FOUND.  Takes O(log n) time.
+     Index find_symbol(const string& name) const;
+
+     //Accessors for the symbol at the passed index, which must be less than get_symbol_count().
+     const char* get_name(Index symbol) const;
+     const char* get_value(Index symbol) const;
+     DepSystem::Symbol_State get_state(Index symbol) const;
+     bool is_marked(Index symbol) const;
+
+     //Returns the indices of the direct dependencies of symbol, including the symbols satisfying its dependency lists, as a [begin,end) range.
+     pair<const Index*,const Index*> get_direct_dependencies(Index symbol) const;
+
+     //Fills to_construct, which must be empty, with the snapshot's symbols, with their values, states, edges, and dependency lists.  Callbacks are not part of a snapshot.
+     //If marked is given, the names of the marked symbols are added to it.  Throws exception if to_construct is not empty.
+     void load_into(DepSystem& to_construct, unordered_set<string>* marked = nullptr) const throw(const char*);
+
+private:
+     struct Header;
+     struct Symbol_Record;
+
+     const char* get_string(Index string_id) const;
+
+     //Our mapping of the snapshot file
+     void* mapping;
+     size_t mapping_size;
+
+     //Pointers to the parts of the mapping
+     const Header* header;
+     const uint64_t* string_offsets;
+     const Symbol_Record* symbol_records;
+     const Index* dependencies;
+     const Index* list_offsets;
+     const Index* list_members;
+     const Index* sorted_symbols;
+     const char* strings;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "file_watcher.hpp"
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+//Everything which can change what a stat() or read of a file returns.  (IN_MODIFY is left out: IN_CLOSE_WRITE follows it, without a flood of events for every write.)
+static const uint32_t WATCH_MASK = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+FileWatcher::FileWatcher() throw(const char*)
+{
+     inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+     if(inotify_fd==-1)
+          throw "Could not initialize inotify.";
+}
+
+FileWatcher::~FileWatcher()
+{
+     close(inotify_fd);
+}
+
+bool FileWatcher::watch_parent(const string& path)
+{
+     size_t slash = path.rfind('/');
+     string prefix = slash==string::npos ? "" : path.substr(0,slash+1);
+     if(watched_prefixes.count(prefix))
+          return true;
+
+     string directory = prefix=="" ? "." : prefix;
+     int watch_descriptor = inotify_add_watch(inotify_fd,directory.c_str(),WATCH_MASK | IN_ONLYDIR);
+     if(watch_descriptor==-1)
+          return false;
+     prefixes[watch_descriptor] = prefix;
+     watched_prefixes.insert(prefix);
+     return true;
+}
+
+bool FileWatcher::wait(unordered_set<string>& changed, int first_timeout_ms, int settle_ms) throw(const char*)
+{
+     bool complete = true;
+     int timeout = first_timeout_ms;
+     while(true)
+     {
+          pollfd inotify_poll = {inotify_fd,POLLIN,0};
+          int ready = poll(&inotify_poll,1,timeout);
+          if(ready==-1)
+          {
+               if(errno==EINTR)
+                    continue;
+               throw "poll() failed while watching for changes.";
+          }
+          if(ready==0)
+               return complete;
+
+          alignas(inotify_event) char buffer[65536];
+          ssize_t bytes_read = read(inotify_fd,buffer,sizeof(buffer));
+          if(bytes_read==-1)
+          {
+               if(errno==EINTR || errno==EAGAIN)
+                    continue;
+               throw "Could not read inotify events.";
+          }
+
+          for(char* next = buffer; next < buffer+bytes_read;)
+          {
+               const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+               next += sizeof(inotify_event)+event->len;
+
+               if(event->mask & IN_Q_OVERFLOW)
+               {
+                    complete = false;
+                    continue;
+               }
+
+               auto prefix = prefixes.find(event->wd);
+               if(prefix==prefixes.end())
+                    continue;
+
+               //A directory which went away (or was moved) is no longer watched; it may be watched again if it comes back.
+               if(event->mask & IN_IGNORED)
+               {
+                    watched_prefixes.erase(prefix->second);
+                    prefixes.erase(prefix);
+                    complete = false;
+                    continue;
+               }
+               if(event->mask & IN_MOVE_SELF)
+                    inotify_rm_watch(inotify_fd,event->wd); //its paths are wrong now
+               if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+               {
+                    complete = false;
+                    continue;
+               }
+
+               if(event->len)
+                    changed.insert(prefix->second+event->name);
+          }
+
+          timeout = settle_ms;
+     }
+}
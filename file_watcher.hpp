@@ -0,0 +1,35 @@
+#ifndef FILE_WATCHER_HPP
+#define FILE_WATCHER_HPP
+
+#include "deplib.hpp"
+
+/*Watches directories with inotify for changes to the files in them.
+  Directories rather than files are watched so that files created, deleted, or replaced by rename are noticed, and so that far fewer watches are needed.*/
+class FileWatcher
+{
+public:
+     //Throws exception if inotify is unavailable.
+     FileWatcher() throw(const char*);
+     ~FileWatcher();
+
+     //Starts watching the directory containing path, unless we already are.  Returns false if it can't be watched (such as when it doesn't exist yet).
+     bool watch_parent(const string& path);
+
+     /*Waits up to first_timeout_ms milliseconds (forever if it's -1) for something in a watched directory to change, then collects the paths of the files changed into changed,
+       continuing until nothing has changed for settle_ms milliseconds, so that a burst of writes is reported at once.
+       Paths are given the same way as they were to watch_parent().
+       Returns false if the kernel dropped events, in which case anything may have changed.*/
+     bool wait(unordered_set<string>& changed, int first_timeout_ms = -1, int settle_ms = 50) throw(const char*);
+
+     //Returns a file descriptor which polls readable when wait() would find changes.
+     int get_fd() const { return inotify_fd; }
+
+private:
+     int inotify_fd;
+
+     //Prefix of the paths in each watched directory ("" for ".", "src/" for "src"), by watch descriptor, and all of those prefixes
+     unordered_map<int,string> prefixes;
+     unordered_set<string> watched_prefixes;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "frozen_depsystem.hpp"
+#include <algorithm>
+
+using std::find;
+using std::make_pair;
+using std::min;
+
+const FrozenDepSystem::Index FrozenDepSystem::NOT_FOUND;
+
+FrozenDepSystem::FrozenDepSystem(const DepSystem& to_freeze) : source(&to_freeze)
+{
+     to_freeze.update_build_order();
+
+     //Number the symbols in build order, skipping the holes left by deleted ones.
+     indices.assign(to_freeze.symbols.size(),NOT_FOUND);
+     for(DepSystem::Id id : to_freeze.build_order)
+          if(id!=DepSystem::NO_SYMBOL)
+          {
+               indices[id] = ids.size();
+               ids.push_back(id);
+          }
+     Index count = ids.size();
+
+     //Forward edges: a symbol's dependency edges, then whatever satisfies its dependency lists that isn't already there
+     dependency_offsets.reserve(count+1);
+     list_offsets.reserve(count);
+     for(DepSystem::Id id : ids)
+     {
+          const DepSystem::Symbol& sym = to_freeze.symbols[id];
+          dependency_offsets.push_back(dependencies.size());
+          for(DepSystem::Id dep : sym.dependency_edges)
+               dependencies.push_back(indices[dep]);
+          list_offsets.push_back(dependencies.size());
+          for(const vector<DepSystem::Id>& dep_list : sym.dependency_list_list)
+               for(DepSystem::Id list_sym : dep_list)
+                    if(to_freeze.exists(list_sym))
+                    {
+                         Index satisfier = indices[list_sym];
+                         if(find(dependencies.begin()+dependency_offsets.back(),dependencies.end(),satisfier)==dependencies.end())
+                              dependencies.push_back(satisfier);
+                         break;
+                    }
+     }
+     dependency_offsets.push_back(dependencies.size());
+
+     //Reverse edges, by counting each symbol's dependents and then placing them; visiting dependents in order leaves each range sorted.
+     dependent_offsets.assign(count+1,0);
+     for(Index dep : dependencies)
+          dependent_offsets[dep+1]++;
+     for(Index i=0; i<count; i++)
+          dependent_offsets[i+1] += dependent_offsets[i];
+     dependents.resize(dependencies.size());
+     vector<Index> next(dependent_offsets.begin(),dependent_offsets.end()-1);
+     for(Index i=0; i<count; i++)
+          for(Index j=dependency_offsets[i]; j<dependency_offsets[i+1]; j++)
+               dependents[next[dependencies[j]]++] = i;
+
+     states.reserve(count);
+     for(DepSystem::Id id : ids)
+          states.push_back(to_freeze.symbols[id].state);
+}
+
+FrozenDepSystem::Index FrozenDepSystem::find_symbol(const string& name) const
+{
+     DepSystem::Id id = source ? source->find_id(name) : DepSystem::NO_SYMBOL;
+     return id<indices.size() ? indices[id] : NOT_FOUND;
+}
+
+const char* FrozenDepSystem::get_name(Index symbol) const
+{
+     return source->names.c_str(ids[symbol]);
+}
+
+const string& FrozenDepSystem::get_value(Index symbol) const
+{
+     return source->symbols[ids[symbol]].value;
+}
+
+pair<const FrozenDepSystem::Index*,const FrozenDepSystem::Index*> FrozenDepSystem::get_dependency_edges(Index symbol) const
+{
+     return make_pair(dependencies.data()+dependency_offsets[symbol],dependencies.data()+list_offsets[symbol]);
+}
+
+pair<const FrozenDepSystem::Index*,const FrozenDepSystem::Index*> FrozenDepSystem::get_direct_dependencies(Index symbol) const
+{
+     return make_pair(dependencies.data()+dependency_offsets[symbol],dependencies.data()+dependency_offsets[symbol+1]);
+}
+
+pair<const FrozenDepSystem::Index*,const FrozenDepSystem::Index*> FrozenDepSystem::get_direct_dependents(Index symbol) const
+{
+     return make_pair(dependents.data()+dependent_offsets[symbol],dependents.data()+dependent_offsets[symbol+1]);
+}
+
+vector<FrozenDepSystem::Index> FrozenDepSystem::get_build_plan(Index symbol) const throw(const char*)
+{
+     /*Dependencies come before their dependents, so walking backwards from symbol reaches everything it depends on.
+       They only fail to if dependency lists made a cycle, leaving the DepSystem without a buildable order to freeze.*/
+     vector<bool> needed(get_symbol_count(),false);
+     needed[symbol] = true;
+     for(Index i=symbol+1; i-- > 0;)
+          if(needed[i])
+               for(Index j=dependency_offsets[i]; j<dependency_offsets[i+1]; j++)
+               {
+                    if(dependencies[j]>=i)
+                         throw "get_build_plan() called with symbol depending on a cycle.";
+                    needed[dependencies[j]] = true;
+               }
+
+     //DISABLED symbols are fine here, as in DepSystem::get_build_plan().
+     vector<Index> to_return;
+     for(Index i=0; i<=symbol; i++)
+          if(needed[i])
+          {
+               if(states[i]==DepSystem::INVALID)
+                    throw "get_build_plan() called with unbuildable symbol.";
+               if(states[i]==DepSystem::NONBUILT || states[i]==DepSystem::STALE)
+                    to_return.push_back(i);
+          }
+     return to_return;
+}
+
+void FrozenDepSystem::invalidate_dependents(const vector<Index>& changed)
+{
+     Index count = get_symbol_count();
+     vector<bool> affected(count,false);
+     Index first = count;
+     for(Index x : changed)
+     {
+          affected[x] = true;
+          first = min(first,x);
+     }
+
+     //Dependencies come before their dependents, so a symbol's dependencies have all been looked at by the time we get to it.
+     for(Index i=first; i<count; i++)
+     {
+          bool depends = false;
+          for(Index j=dependency_offsets[i]; j<dependency_offsets[i+1] && !depends; j++)
+               depends = affected[dependencies[j]];
+          if(!depends)
+               continue;
+
+          affected[i] = true;
+          switch(states[i])
+          {
+          case DepSystem::DISABLED:
+               states[i] = DepSystem::INVALID;
+               break;
+
+          case DepSystem::VALID:
+               states[i] = DepSystem::STALE;
+               break;
+          }
+     }
+}
+
+void FrozenDepSystem::build_single_symbol(Index symbol) throw(const char*)
+{
+     const DepSystem::Symbol& sym = source->symbols[ids[symbol]];
+     if(sym.callback)
+          sym.callback(source->names.get(ids[symbol]),sym.value);
+     states[symbol] = DepSystem::VALID;
+}
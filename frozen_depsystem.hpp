@@ -0,0 +1,79 @@
+#ifndef FROZEN_DEPSYSTEM_HPP
+#define FROZEN_DEPSYSTEM_HPP
+
+#include "deplib.hpp"
+#include <cstdint>
+#include <utility>
+
+using std::pair;
+
+/*The structure of a DepSystem, frozen for building it: once generators have finished, nothing adds or removes symbols or edges until the next run of the Bakefile.
+  Symbols are numbered densely in buildable order, so a symbol's dependencies always have smaller indices than it does,
+  and its dependencies and dependents are contiguous ranges of shared arrays (compressed sparse rows), so walking the graph is a sweep over arrays rather than a chain of hash lookups.
+  States are a separate array of bytes, ours alone: changing them leaves the DepSystem's alone.
+  Names, values, and callbacks are those of the DepSystem we were frozen from, which must outlive us and not be changed while we're in use.*/
+class FrozenDepSystem
+{
+public:
+     //Index of a symbol in the frozen graph
+     typedef uint32_t Index;
+     static const Index NOT_FOUND = -1;
+
+     //An empty graph, for assigning a frozen one to later
+     FrozenDepSystem() : source(NULL) {}
+
+     //Freezes to_freeze, as DepSystem::freeze() does.  to_freeze must not be in a batch.
+     explicit FrozenDepSystem(const DepSystem& to_freeze);
+
+     //Returns the number of symbols.
+     Index get_symbol_count() const { return states.size(); }
+
+     //Returns index of the symbol with the passed name, or NOT_FOUND.
+     Index find_symbol(const string& name) const;
+
+     //Accessors for the symbol at the passed index, which must be less than get_symbol_count().
+     const char* get_name(Index symbol) const;
+     const string& get_value(Index symbol) const;
+     DepSystem::Symbol_State get_state(Index symbol) const { return DepSystem::Symbol_State(states[symbol]); }
+     void set_state(Index symbol, DepSystem::Symbol_State new_state) { states[symbol] = new_state; }
+
+     //Returns the indices of the direct dependency edges of symbol, without those of its dependency lists, as a [begin,end) range.
+     pair<const Index*,const Index*> get_dependency_edges(Index symbol) const;
+
+     //Returns the indices of the direct dependencies of symbol, including the symbols satisfying its dependency lists, as a [begin,end) range.  Each appears once.
+     pair<const Index*,const Index*> get_direct_dependencies(Index symbol) const;
+
+     //Returns the indices of the symbols with symbol among their direct dependencies, in increasing order, as a [begin,end) range.
+     pair<const Index*,const Index*> get_direct_dependents(Index symbol) const;
+
+     //As DepSystem::get_build_plan(): returns the stale or nonbuilt symbols symbol depends on, and symbol itself if it is, in increasing order.
+     //Throws exception if there's no way to build symbol, including if it depends on a cycle made by dependency lists.
+     vector<Index> get_build_plan(Index symbol) const throw(const char*);
+
+     /*Marks all valid symbols which depend on any of the passed symbols as stale (and all disabled symbols invalid), as DepSystem::invalidate_dependents() does for each of them.
+       This is one sweep from the smallest of them to the end of the graph, however many there are.*/
+     void invalidate_dependents(const vector<Index>& changed);
+
+     //As DepSystem::build_single_symbol(): invokes the build function of this symbol alone and marks it valid.
+     void build_single_symbol(Index symbol) throw(const char*);
+
+private:
+     const DepSystem* source;
+
+     //ID in source of the symbol at each index, and index of each ID (NOT_FOUND for names which aren't symbols)
+     vector<DepSystem::Id> ids;
+     vector<Index> indices;
+
+     //The dependencies of symbol i are dependencies[dependency_offsets[i],dependency_offsets[i+1]); those from dependency lists start at list_offsets[i].
+     vector<Index> dependency_offsets;
+     vector<Index> list_offsets;
+     vector<Index> dependencies;
+
+     //The dependents of symbol i are dependents[dependent_offsets[i],dependent_offsets[i+1]).
+     vector<Index> dependent_offsets;
+     vector<Index> dependents;
+
+     vector<uint8_t> states;
+};
+
+#endif
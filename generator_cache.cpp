@@ -0,0 +1,179 @@
+#include "generator_cache.hpp"
+#include "bake_stats.hpp"
+#include "hash_cache.hpp"
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <glob.h>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::ifstream;
+using std::istreambuf_iterator;
+using std::ofstream;
+using std::rename;
+using std::snprintf;
+using std::strlen;
+
+static const char* const CACHE_HEADER = "# bake generator cache v1";
+
+//Fingerprints are chained by seeding each hash with the previous fingerprint.
+static uint64_t fingerprint(uint64_t seed, const void* data, size_t size)
+{
+     return HashCache::hash_bytes(data,size,seed);
+}
+
+static const uint64_t EMPTY_FINGERPRINT = 0;
+
+static uint64_t fingerprint(uint64_t seed, const string& data)
+{
+     return fingerprint(seed,data.c_str(),data.size()+1); //include the NUL, so concatenations of different strings differ
+}
+
+static string to_hex(uint64_t value)
+{
+     char buffer[17];
+     snprintf(buffer,sizeof(buffer),"%016llx",(unsigned long long)value);
+     return buffer;
+}
+
+//Fingerprints what each pattern matches and the status of each match.
+static uint64_t fingerprint_inputs(const vector<string>& inputs)
+{
+     uint64_t to_return = EMPTY_FINGERPRINT;
+     for(const string& pattern : inputs)
+     {
+          to_return = fingerprint(to_return,pattern);
+
+          //A pattern matching nothing is left as is, so it's fingerprinted as a missing file.
+          //A failed glob() may still have matched some paths, so what it matched is freed whether it failed or not.
+          glob_t matches;
+          if(glob(pattern.c_str(),GLOB_NOCHECK,NULL,&matches)!=0)
+          {
+               globfree(&matches);
+               continue;
+          }
+          for(size_t i=0; i<matches.gl_pathc; i++)
+          {
+               const char* path = matches.gl_pathv[i];
+               to_return = fingerprint(to_return,path,strlen(path)+1);
+
+               struct stat statbuf;
+               BAKE_COUNT(STAT_CALLS,1);
+               if(stat(path,&statbuf)==-1)
+                    continue;
+               uint64_t status[] = {(uint64_t)(statbuf.st_mode & S_IFMT),(uint64_t)statbuf.st_size,(uint64_t)statbuf.st_ino,
+                                    (uint64_t)statbuf.st_mtim.tv_sec,(uint64_t)statbuf.st_mtim.tv_nsec};
+               to_return = fingerprint(to_return,status,sizeof(status));
+          }
+          globfree(&matches);
+     }
+
+     return to_return;
+}
+
+string GeneratorCache::path_for(const string& bakefile)
+{
+     size_t slash = bakefile.rfind('/');
+     if(slash==string::npos)
+          return ".bake_cache";
+     return bakefile.substr(0,slash+1)+".bake_cache";
+}
+
+GeneratorCache::GeneratorCache(const string& directory_) : directory(directory_), history(EMPTY_FINGERPRINT), grouped(false), group_history(EMPTY_FINGERPRINT), group_sum(0) {}
+
+string GeneratorCache::entry_name(const string& command) const
+{
+     return to_hex(fingerprint(grouped ? group_history : history,command));
+}
+
+bool GeneratorCache::find(const string& command, const vector<string>& inputs, uint64_t& inputs_fingerprint, string& output)
+{
+     inputs_fingerprint = EMPTY_FINGERPRINT;
+     if(!inputs.size())
+          return false;
+
+     //Fingerprint the inputs now, before the command can run, so that changes made while it runs show up next time.
+     inputs_fingerprint = fingerprint_inputs(inputs);
+
+     string name = entry_name(command);
+     ifstream fin(directory+"/"+name,std::ios::binary);
+     string header, recorded_fingerprint;
+     getline(fin,header);
+     getline(fin,recorded_fingerprint);
+     if(!fin.good() || header!=CACHE_HEADER || recorded_fingerprint!=to_hex(inputs_fingerprint))
+          return false;
+     string cached_output((istreambuf_iterator<char>(fin)),istreambuf_iterator<char>());
+     if(fin.bad())
+          return false;
+
+     used_entries.insert(name);
+     record(command,cached_output);
+     output = std::move(cached_output);
+     return true;
+}
+
+void GeneratorCache::add(const string& command, const vector<string>& inputs, uint64_t inputs_fingerprint, const string& output)
+{
+     if(inputs.size())
+     {
+          //Failing to save just means running the command again next time.
+          string name = entry_name(command);
+          string temp_path = directory+"/"+name+".tmp";
+          mkdir(directory.c_str(),0777);
+          ofstream fout(temp_path,std::ios::binary);
+          fout << CACHE_HEADER << '\n' << to_hex(inputs_fingerprint) << '\n' << output;
+          fout.close();
+          if(fout.good() && rename(temp_path.c_str(),(directory+"/"+name).c_str())==0)
+               used_entries.insert(name);
+          else
+               unlink(temp_path.c_str());
+     }
+
+     record(command,output);
+}
+
+void GeneratorCache::record(const string& command, const string& output)
+{
+     if(grouped)
+          group_sum += fingerprint(fingerprint(group_history,command),output);
+     else
+          history = fingerprint(fingerprint(history,command),output);
+}
+
+void GeneratorCache::begin_group()
+{
+     grouped = true;
+     group_history = history;
+     group_sum = 0;
+}
+
+void GeneratorCache::end_group()
+{
+     grouped = false;
+     history = fingerprint(group_history,&group_sum,sizeof(group_sum));
+}
+
+void GeneratorCache::prune()
+{
+     DIR* cache_dir = opendir(directory.c_str());
+     if(!cache_dir)
+          return;
+
+     while(struct dirent* entry = readdir(cache_dir))
+          if(entry->d_name[0]!='.' && !used_entries.count(entry->d_name))
+               unlinkat(dirfd(cache_dir),entry->d_name,0);
+     closedir(cache_dir);
+}
+
+uint64_t GeneratorCache::get_fingerprint() const
+{
+     return history;
+}
+
+string GeneratorCache::get_snapshot_path() const
+{
+     return directory+"/.graph"; //prune() leaves dotfiles alone
+}
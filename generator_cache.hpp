@@ -0,0 +1,65 @@
+#ifndef GENERATOR_CACHE_HPP
+#define GENERATOR_CACHE_HPP
+
+#include "deplib.hpp"
+#include <cstdint>
+
+/*Output of Bakefile commands from previous runs, kept in ".bake_cache" next to the Bakefile.
+  A command may declare the files, directories, and glob patterns it reads with a "#bake-inputs" line before it.
+  If a command's inputs are unchanged, and every command before it produced what it did last time
+  (so that it would be given the same graph on standard input), its output is replayed rather than running it again.
+  Files are compared by size, inode, and nanosecond modification time, directories by their list of entries (via their modification time),
+  and globs by what they match.  Commands without declared inputs are always run.*/
+class GeneratorCache
+{
+public:
+     //Returns the path of the cache directory belonging to the passed Bakefile.
+     static string path_for(const string& bakefile);
+
+     explicit GeneratorCache(const string& directory);
+
+     /*Looks for output of command from a previous run, given the patterns it declared as inputs, setting inputs_fingerprint to the fingerprint of what they matched.
+       If there is output we can use, sets output to it and returns true; otherwise, the command must be run, and its output passed to add().*/
+     bool find(const string& command, const vector<string>& inputs, uint64_t& inputs_fingerprint, string& output);
+
+     //Records what command produced, saving it for future runs, under the inputs_fingerprint find() gave for it, if it declared inputs.
+     void add(const string& command, const vector<string>& inputs, uint64_t inputs_fingerprint, const string& output);
+
+     /*Starts a group of commands from a "#bake-parallel" line, each of which is given the graph from before the group.
+       Until end_group(), each is looked up and recorded as though it came right after the commands before the group.*/
+     void begin_group();
+
+     //Ends the group; the commands after it are looked up given what every command in it produced, in any order, as they can't conflict.
+     void end_group();
+
+     //Deletes cached output not used by this run.  Should only be called once every command has been found or added.
+     void prune();
+
+     //Returns the fingerprint of every command so far and its output, which determines the graph they make when started from an empty one.
+     uint64_t get_fingerprint() const;
+
+     //Returns the path of the snapshot of the graph the commands made, which is kept with their output, tagged with get_fingerprint() (see depsnapshot.hpp).
+     string get_snapshot_path() const;
+
+private:
+     //Returns name of the file holding output for command, given what came before it.
+     string entry_name(const string& command) const;
+
+     string directory;
+
+     //Fingerprint of every command so far and its output
+     uint64_t history;
+
+     //While in a group, history as of its start, and the sum of the fingerprints of its commands and their output so far
+     bool grouped;
+     uint64_t group_history;
+     uint64_t group_sum;
+
+     //Accounts for command having produced output in history.
+     void record(const string& command, const string& output);
+
+     //Entries found or added this run
+     unordered_set<string> used_entries;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "generator_pipeline.hpp"
+#include "bake_stats.hpp"
+#include "bake_utilities.hpp"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::chrono::steady_clock;
+
+//Makes text output end with a newline, so that whatever follows it in the stream starts a record of its own.
+static void end_line(string& output)
+{
+     if(output.size() && output[0]!='\0' && output.back()!='\n')
+          output += '\n';
+}
+
+GeneratorPipeline::GeneratorPipeline(const string& input_) : input(input_), input_converted(false), next_stage(0), grouped(false), group_start(0) {}
+
+GeneratorPipeline::~GeneratorPipeline()
+{
+     for(Stage& stage : stages)
+     {
+          for(int fd : {stage.to_child,stage.from_child})
+               if(fd!=-1)
+                    close(fd);
+          if(stage.pid!=-1)
+          {
+               kill(stage.pid,SIGTERM);
+               waitpid(stage.pid,NULL,0);
+          }
+     }
+}
+
+void GeneratorPipeline::add_output(const string& output)
+{
+     stages.push_back(Stage{"",-1,-1,-1,output,false,"",false,0,0,next_last_segment(),steady_clock::now()});
+     end_line(stages.back().output);
+}
+
+void GeneratorPipeline::add_command(const string& command, bool binary) throw(const char*)
+{
+     int to_child, from_child;
+     pid_t pid = bake_utilities::bakery_start(command,to_child,from_child,binary);
+     fcntl(to_child,F_SETFL,O_NONBLOCK);
+     stages.push_back(Stage{command,pid,to_child,from_child,"",binary,"",false,0,0,next_last_segment(),steady_clock::now()});
+}
+
+void GeneratorPipeline::begin_group()
+{
+     grouped = true;
+     group_start = stages.size();
+}
+
+void GeneratorPipeline::end_group()
+{
+     grouped = false;
+}
+
+size_t GeneratorPipeline::next_last_segment() const
+{
+     return grouped ? group_start : stages.size();
+}
+
+const string& GeneratorPipeline::get_segment(size_t segment, bool binary, bool& complete) throw(const char*)
+{
+     static const string nothing;
+     const string& raw = segment ? stages[segment-1].output : input;
+     complete = !segment || stages[segment-1].from_child==-1;
+
+     //Its first byte tells us its framing, so until it has one, we don't know whether it needs converting.
+     if(!raw.size() || (raw[0]=='\0')==binary)
+          return raw;
+     if(!complete)
+          return nothing;
+
+     string& converted = segment ? stages[segment-1].converted_output : converted_input;
+     bool& is_converted = segment ? stages[segment-1].converted : input_converted;
+     if(!is_converted)
+     {
+          converted = bake_utilities::convert_interchange(raw,binary);
+          is_converted = true;
+     }
+     return converted;
+}
+
+bool GeneratorPipeline::feed(Stage& stage) throw(const char*)
+{
+     while(stage.segment <= stage.last_segment)
+     {
+          bool complete;
+          const string& segment = get_segment(stage.segment,stage.binary,complete);
+          if(stage.offset==segment.size())
+          {
+               if(!complete)
+                    return false;
+               stage.segment++;
+               stage.offset = 0;
+               continue;
+          }
+
+          ssize_t written = write(stage.to_child,segment.data()+stage.offset,segment.size()-stage.offset);
+          if(written>0)
+          {
+               BAKE_COUNT(BYTES_TO_CHILDREN,written);
+               stage.offset += written;
+          }
+          else if(errno==EAGAIN)
+               return true;
+          else if(errno!=EINTR)
+               break; //the command doesn't want the rest
+     }
+
+     close(stage.to_child);
+     stage.to_child = -1;
+     return false;
+}
+
+void GeneratorPipeline::drain(Stage& stage)
+{
+     char buffer[65536];
+     ssize_t bytes_read = read(stage.from_child,buffer,sizeof(buffer));
+     if(bytes_read>0)
+     {
+          BAKE_COUNT(BYTES_FROM_CHILDREN,bytes_read);
+          stage.output.append(buffer,bytes_read);
+     }
+     else if(bytes_read==0 || errno!=EINTR)
+     {
+          close(stage.from_child);
+          stage.from_child = -1;
+          end_line(stage.output);
+     }
+}
+
+bool GeneratorPipeline::next(string& output) throw(const char*)
+{
+     if(next_stage==stages.size())
+          return false;
+
+     //A command that exits without reading all its input mustn't kill us with SIGPIPE.
+     sigset_t sigpipe, old_mask;
+     sigemptyset(&sigpipe);
+     sigaddset(&sigpipe,SIGPIPE);
+     pthread_sigmask(SIG_BLOCK,&sigpipe,&old_mask);
+
+     //Take back any SIGPIPE a write raised, so it isn't delivered once we unblock it.
+     auto unblock_sigpipe = [&]()
+     {
+          timespec no_wait = {0,0};
+          while(sigtimedwait(&sigpipe,NULL,&no_wait)>0);
+          pthread_sigmask(SIG_SETMASK,&old_mask,NULL);
+     };
+
+     //Keep every command after us fed and drained, too, until ours is done.
+     Stage& head = stages[next_stage];
+     vector<pollfd> fds;
+     vector<Stage*> readers;
+     try
+     {
+          while(true)
+          {
+               fds.clear();
+               readers.clear();
+               for(size_t i=next_stage; i<stages.size(); i++)
+               {
+                    Stage& stage = stages[i];
+                    if(stage.to_child!=-1 && feed(stage))
+                    {
+                         fds.push_back(pollfd{stage.to_child,POLLOUT,0});
+                         readers.push_back(NULL);
+                    }
+                    if(stage.from_child!=-1)
+                    {
+                         fds.push_back(pollfd{stage.from_child,POLLIN,0});
+                         readers.push_back(&stage);
+                    }
+               }
+               if(head.to_child==-1 && head.from_child==-1)
+                    break;
+
+               if(poll(fds.data(),fds.size(),-1)==-1)
+               {
+                    if(errno==EINTR)
+                         continue;
+                    break;
+               }
+               for(size_t i=0; i<fds.size(); i++)
+                    if(readers[i] && fds[i].revents)
+                         drain(*readers[i]);
+          }
+     }
+     catch(const char* error)
+     {
+          unblock_sigpipe();
+          throw;
+     }
+     unblock_sigpipe();
+
+     //The commands after us may still be reading our output, so it's copied rather than moved.
+     next_stage++;
+     output = head.output;
+     if(head.pid==-1)
+          return true;
+
+     //Ensure command completed normally by waiting on child.
+     siginfo_t child_status;
+     while(waitid(P_PID,head.pid,&child_status,WEXITED)==-1 && errno==EINTR);
+     bake_trace::record(bake_trace::command_name(head.command),"generator",head.begin,steady_clock::now(),bake_trace::GENERATOR_ROWS+next_stage,{{"pid",head.pid},{"cached",0},{"output_bytes",output.size()}});
+     head.pid = -1;
+     if(child_status.si_code!=CLD_EXITED)
+          throw StringFunctions::permanent_c_str(head.command+": terminated by signal "+to_string(child_status.si_status));
+     else if(child_status.si_status!=0)
+          throw StringFunctions::permanent_c_str(head.command+": exited with abnormal status "+to_string(child_status.si_status));
+     return true;
+}
@@ -0,0 +1,82 @@
+#ifndef GENERATOR_PIPELINE_HPP
+#define GENERATOR_PIPELINE_HPP
+
+#include "bake_trace.hpp"
+#include <sys/types.h>
+
+/*The commands of a Bakefile, run as a pipeline.  Each command starts without waiting for those before it;
+  its standard input is the graph we started with followed by the output of every command before it, in order, streamed as it's produced.
+  A command's standard input ends once every command before it has finished.
+  Since records later in the stream override those before them, that's the same graph the command would be given if they ran one at a time.
+  Stages added between begin_group() and end_group() are independent of each other: each is given only what came before the group.
+  Each command reads one framing of the Baker Interchange Format; what's in the other is converted for it, which has to wait for the whole of it.*/
+class GeneratorPipeline
+{
+public:
+     //input is the graph we started with, in Baker Interchange Format.
+     explicit GeneratorPipeline(const string& input);
+
+     //Kills and waits on any command still running.
+     ~GeneratorPipeline();
+
+     //Adds a stage whose output is already known, such as from GeneratorCache.
+     void add_output(const string& output);
+
+     //Starts command as the next stage, reading the binary framing if binary is set.  Throws exception if it can't be executed.
+     void add_command(const string& command, bool binary = false) throw(const char*);
+
+     //Starts and ends a group of independent stages.
+     void begin_group();
+     void end_group();
+
+     /*Waits for the earliest stage not yet taken to finish, setting output to its output.
+       Returns false if every stage has been taken.  Throws exception if its command exits abnormally, or if what a command reads can't be converted for it.*/
+     bool next(string& output) throw(const char*);
+
+private:
+     struct Stage
+     {
+          string command; //"" if output was known when the stage was added
+          pid_t pid;
+          int to_child; //-1 once closed
+          int from_child; //-1 once closed
+          string output;
+          bool binary; //whether the command reads the binary framing
+
+          //output in the other framing, once a command needed it
+          string converted_output;
+          bool converted;
+
+          //What we've written to the command: segment 0 is our input, and segment N the output of stage N-1.  Its input ends with segment last_segment.
+          size_t segment;
+          size_t offset;
+          size_t last_segment;
+
+          bake_trace::Time begin;
+     };
+
+     /*Returns segment of our stream in the binary framing if binary is set, and as text otherwise, and whether it's complete.
+       Returns nothing, as incomplete, for a segment which needs converting until it's complete.*/
+     const string& get_segment(size_t segment, bool binary, bool& complete) throw(const char*);
+
+     //Writes what's ready to stage's standard input, closing it once there's no more to come.  Returns whether there's more ready than the pipe would take.
+     bool feed(Stage& stage) throw(const char*);
+
+     //Reads what stage's command wrote.
+     void drain(Stage& stage);
+
+     string input;
+     string converted_input;
+     bool input_converted;
+     vector<Stage> stages;
+     size_t next_stage;
+
+     //The first stage of the current group, if we're in one
+     bool grouped;
+     size_t group_start;
+
+     //Returns the last segment the next stage added reads.
+     size_t next_last_segment() const;
+};
+
+#endif
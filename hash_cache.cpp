@@ -0,0 +1,253 @@
+#include "hash_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using std::atomic;
+using std::hex;
+using std::ifstream;
+using std::istringstream;
+using std::make_pair;
+using std::max;
+using std::memcpy;
+using std::min;
+using std::ofstream;
+using std::pair;
+using std::rename;
+using std::thread;
+
+static const char* const HASHES_HEADER = "# bake hashes v1";
+
+//As in StatCache::prefetch(), but with smaller batches: a file takes much longer to hash than to stat.
+static const size_t PREFETCH_BATCH = 64;
+static const long MAX_PREFETCH_THREADS = 32;
+
+//Files modified this recently when we hash them may be modified again without their mtime changing (see Entry::trusted).
+static const time_t UNTRUSTED_SECONDS = 2;
+
+static const uint64_t PRIME64_1 = 11400714785074694791ull;
+static const uint64_t PRIME64_2 = 14029467366897019727ull;
+static const uint64_t PRIME64_3 = 1609587929392839161ull;
+static const uint64_t PRIME64_4 = 9650029242287828579ull;
+static const uint64_t PRIME64_5 = 2870177450012600261ull;
+
+static inline uint64_t rotate_left(uint64_t x, int bits)
+{
+     return (x << bits) | (x >> (64-bits));
+}
+
+//Reads little-endian integers; unaligned reads are fine on everything we run on.
+static inline uint64_t read64(const unsigned char* p) { uint64_t x; memcpy(&x,p,sizeof(x)); return x; }
+static inline uint32_t read32(const unsigned char* p) { uint32_t x; memcpy(&x,p,sizeof(x)); return x; }
+
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t input)
+{
+     return rotate_left(accumulator+input*PRIME64_2,31)*PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t accumulator, uint64_t value)
+{
+     return (accumulator^xxh64_round(0,value))*PRIME64_1+PRIME64_4;
+}
+
+uint64_t HashCache::hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+     const unsigned char* p = static_cast<const unsigned char*>(data);
+     const unsigned char* end = p+size;
+     uint64_t hash;
+
+     if(size>=32)
+     {
+          //Four independent lanes, so the processor can work on them at once.
+          uint64_t v1 = seed+PRIME64_1+PRIME64_2, v2 = seed+PRIME64_2, v3 = seed, v4 = seed-PRIME64_1;
+          for(; p+32<=end; p+=32)
+          {
+               v1 = xxh64_round(v1,read64(p));
+               v2 = xxh64_round(v2,read64(p+8));
+               v3 = xxh64_round(v3,read64(p+16));
+               v4 = xxh64_round(v4,read64(p+24));
+          }
+          hash = rotate_left(v1,1)+rotate_left(v2,7)+rotate_left(v3,12)+rotate_left(v4,18);
+          hash = xxh64_merge_round(hash,v1);
+          hash = xxh64_merge_round(hash,v2);
+          hash = xxh64_merge_round(hash,v3);
+          hash = xxh64_merge_round(hash,v4);
+     }
+     else
+          hash = seed+PRIME64_5;
+     hash += size;
+
+     for(; p+8<=end; p+=8)
+          hash = rotate_left(hash^xxh64_round(0,read64(p)),27)*PRIME64_1+PRIME64_4;
+     if(p+4<=end)
+     {
+          hash = rotate_left(hash^(read32(p)*PRIME64_1),23)*PRIME64_2+PRIME64_3;
+          p += 4;
+     }
+     for(; p<end; p++)
+          hash = rotate_left(hash^(*p*PRIME64_5),11)*PRIME64_1;
+
+     hash ^= hash >> 33;
+     hash *= PRIME64_2;
+     hash ^= hash >> 29;
+     hash *= PRIME64_3;
+     hash ^= hash >> 32;
+     return hash;
+}
+
+string HashCache::path_for(const string& bakefile)
+{
+     size_t slash = bakefile.rfind('/');
+     if(slash==string::npos)
+          return ".bake_hashes";
+     return bakefile.substr(0,slash+1)+".bake_hashes";
+}
+
+void HashCache::load(const string& path)
+{
+     entries.clear();
+
+     ifstream fin(path);
+     string line;
+     getline(fin,line);
+     if(!fin.good() || line!=HASHES_HEADER)
+          return;
+
+     //Each line is "hash inode size mtime_seconds mtime_nanoseconds path"; the path is the rest of the line.
+     while(getline(fin,line))
+     {
+          istringstream fields(line);
+          Entry entry;
+          if(!(fields >> hex >> entry.hash >> std::dec >> entry.inode >> entry.size >> entry.mtime.tv_sec >> entry.mtime.tv_nsec) || fields.get()!=' ')
+               continue;
+          entry.trusted = true;
+          string file;
+          getline(fields,file);
+          if(file!="")
+               entries[file] = entry;
+     }
+}
+
+bool HashCache::save(const string& path) const
+{
+     string temp_path = path+".tmp";
+     ofstream fout(temp_path);
+     fout << HASHES_HEADER << '\n';
+     for(const auto& entry : entries)
+          if(entry.second.trusted && entry.first.find('\n')==string::npos)
+               fout << hex << entry.second.hash << std::dec << ' ' << entry.second.inode << ' ' << entry.second.size << ' '
+                    << entry.second.mtime.tv_sec << ' ' << entry.second.mtime.tv_nsec << ' ' << entry.first << '\n';
+     fout.close();
+
+     if(!fout.good())
+          return false;
+     return rename(temp_path.c_str(),path.c_str())==0;
+}
+
+bool HashCache::matches(const Entry& entry, const StatCache::Status& status)
+{
+     return entry.inode==status.inode && entry.size==status.size && entry.mtime.tv_sec==status.mtime.tv_sec && entry.mtime.tv_nsec==status.mtime.tv_nsec;
+}
+
+//Hashes size bytes read from fd, returning 0 if they can't be read.
+static uint64_t hash_fd(int fd, off_t size)
+{
+     if(!size)
+          return HashCache::hash_bytes(NULL,0);
+
+     void* contents = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+     if(contents==MAP_FAILED)
+          return 0;
+     madvise(contents,size,MADV_SEQUENTIAL);
+     uint64_t to_return = HashCache::hash_bytes(contents,size);
+     munmap(contents,size);
+     return to_return;
+}
+
+uint64_t HashCache::hash_file(const string& path)
+{
+     int fd = open(path.c_str(),O_RDONLY|O_CLOEXEC);
+     if(fd==-1)
+          return 0;
+     struct stat statbuf;
+     uint64_t to_return = fstat(fd,&statbuf)==0 ? hash_fd(fd,statbuf.st_size) : 0;
+     close(fd);
+     return to_return;
+}
+
+HashCache::Entry HashCache::make_entry(const string& path, const StatCache::Status& status)
+{
+     Entry to_return;
+     to_return.hash = 0;
+     to_return.inode = status.inode;
+     to_return.size = status.size;
+     to_return.mtime = status.mtime;
+     to_return.trusted = false;
+
+     int fd = open(path.c_str(),O_RDONLY|O_CLOEXEC);
+     if(fd==-1)
+          return to_return;
+     to_return.hash = hash_fd(fd,status.size);
+     close(fd);
+
+     to_return.trusted = to_return.hash && status.mtime.tv_sec+UNTRUSTED_SECONDS < time(NULL);
+     return to_return;
+}
+
+void HashCache::prefetch(const vector<string>& paths, StatCache& stat_cache)
+{
+     //Find what needs hashing first: StatCache isn't safe to use from our workers.
+     //A path given more than once is only hashed once.
+     vector<pair<const string*,const StatCache::Status*>> to_hash;
+     unordered_set<string> queued;
+     for(const string& path : paths)
+     {
+          const StatCache::Status& status = stat_cache.get(path);
+          auto entry = entries.find(path);
+          if(status.exists && (entry==entries.end() || !matches(entry->second,status)) && queued.insert(path).second)
+               to_hash.push_back(make_pair(&path,&status));
+     }
+
+     vector<Entry> results(to_hash.size());
+     atomic<size_t> next_batch(0);
+     auto worker = [&]()
+          {
+               size_t begin;
+               while((begin = next_batch.fetch_add(PREFETCH_BATCH)) < to_hash.size())
+                    for(size_t i=begin; i<min(begin+PREFETCH_BATCH,to_hash.size()); i++)
+                         results[i] = make_entry(*to_hash[i].first,*to_hash[i].second);
+          };
+
+     long thread_count = min(min(max(sysconf(_SC_NPROCESSORS_ONLN),1L)*4,MAX_PREFETCH_THREADS),(long)(to_hash.size()/PREFETCH_BATCH));
+     vector<thread> threads;
+     for(long i=1; i<thread_count; i++)
+          threads.emplace_back(worker);
+     worker();
+     for(thread& x : threads)
+          x.join();
+
+     for(size_t i=0; i<to_hash.size(); i++)
+          entries[*to_hash[i].first] = results[i];
+}
+
+uint64_t HashCache::get(const string& path, StatCache& stat_cache)
+{
+     const StatCache::Status& status = stat_cache.get(path);
+     if(!status.exists)
+          return 0;
+
+     auto entry = entries.find(path);
+     if(entry!=entries.end() && matches(entry->second,status))
+          return entry->second.hash;
+     Entry hashed = make_entry(path,status);
+     entries[path] = hashed;
+     return hashed.hash;
+}
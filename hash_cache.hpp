@@ -0,0 +1,55 @@
+#ifndef HASH_CACHE_HPP
+#define HASH_CACHE_HPP
+
+#include "stat_cache.hpp"
+#include <cstdint>
+
+/*Content hashes of files, kept between runs in ".bake_hashes" next to the Bakefile.
+  A file is only read again when its inode, size, or modification time differ from when it was last hashed.*/
+class HashCache
+{
+public:
+     //XXH64 of the passed bytes.  Also used to fingerprint anything else bake needs to compare between runs.
+     static uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+     //Returns the hash of the contents of the file at path, reading it whole, or 0 if it can't be read.
+     static uint64_t hash_file(const string& path);
+
+     //Returns the path of the hash cache belonging to the passed Bakefile.
+     static string path_for(const string& bakefile);
+
+     //Replaces our hashes with those in the file at path.  A missing, unreadable, or outdated file simply leaves us empty.
+     void load(const string& path);
+
+     //Writes our hashes to path, replacing the file atomically.  Returns whether the file could be written.
+     bool save(const string& path) const;
+
+     //Hashes every one of paths whose recorded hash is out of date, spread across a number of threads.  A path may be given more than once.
+     void prefetch(const vector<string>& paths, StatCache& stat_cache);
+
+     //Returns the hash of the contents of path, or 0 if it doesn't exist or can't be read.
+     uint64_t get(const string& path, StatCache& stat_cache);
+
+private:
+     struct Entry
+     {
+          uint64_t hash;
+          ino_t inode;
+          off_t size;
+          timespec mtime;
+
+          /*Whether the file is old enough that it could not have been modified again within the same mtime tick after we hashed it.
+            Entries which aren't are still used this run, but aren't saved.*/
+          bool trusted;
+     };
+
+     //Returns whether entry describes a file with status status.
+     static bool matches(const Entry& entry, const StatCache::Status& status);
+
+     //Hashes the file at path, which had status status.
+     static Entry make_entry(const string& path, const StatCache::Status& status);
+
+     unordered_map<string,Entry> entries;
+};
+
+#endif
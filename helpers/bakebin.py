@@ -0,0 +1,135 @@
+#Reads and writes the Baker Interchange Format, as text or in its binary framing, for generators written in Python.
+#bake gives a command the binary framing, and sets BAKE_INTERCHANGE=binary for it, when the command is preceded by a "#bake-binary" line.
+#
+#Usage:
+#  import bakebin
+#  for record in bakebin.read_records():
+#      ...  #("symbol", name, command), ("dependency", dependency, dependent), or ("attribute", name, attribute)
+#  out = bakebin.Writer()
+#  out.symbol("hello.o", "gcc -c hello.cpp")
+#  out.dependency("hello.cpp", "hello.o")
+#  out.attribute("hello.o", "restat")
+
+import os
+import struct
+import sys
+
+MAGIC = b"\0BAKEBIF"
+RECORD_TYPES = {b"S": "symbol", b"D": "dependency", b"A": "attribute"}
+
+#Whether bake asked for the binary framing: our standard input is in it, and our standard output may be.
+def binary_requested():
+    return os.environ.get("BAKE_INTERCHANGE") == "binary"
+
+def _stdin():
+    return getattr(sys.stdin, "buffer", sys.stdin)
+
+def _stdout():
+    return getattr(sys.stdout, "buffer", sys.stdout)
+
+#Names and commands are bytes in the streams; we give them to Python as str.
+def _decode(field):
+    if str is bytes:
+        return field
+    return field.decode("utf-8", "surrogateescape")
+
+def _encode(field):
+    if isinstance(field, bytes):
+        return field
+    return field.encode("utf-8", "surrogateescape")
+
+def _read_field(data, offset):
+    if len(data) - offset < 4:
+        raise ValueError("Truncated binary interchange record.")
+    length, = struct.unpack_from("<I", data, offset)
+    offset += 4
+    if len(data) - offset < length:
+        raise ValueError("Truncated binary interchange record.")
+    return _decode(data[offset:offset+length]), offset+length
+
+def _binary_records(data):
+    offset = 0
+    while offset < len(data):
+        if data[offset:offset+1] == b"\0":
+            if data[offset:offset+len(MAGIC)] != MAGIC:
+                raise ValueError("Invalid binary interchange preamble.")
+            offset += len(MAGIC)
+            continue
+        kind = RECORD_TYPES.get(data[offset:offset+1])
+        if kind is None:
+            raise ValueError("Invalid binary interchange record.")
+        first, offset = _read_field(data, offset+1)
+        second, offset = _read_field(data, offset)
+        yield (kind, first, second)
+
+#Sentinels ("<<EOF") make a command span lines; this finds where they end, as bake does, though it doesn't check the line is well formed.
+def _sentinels(line):
+    marks = []
+    words = line.split()
+    for word in words[1:]:
+        if word.startswith("<<") and len(word) > 2:
+            marks.append(word[2:])
+    return marks
+
+def _text_records(data):
+    lines = _decode(data).split("\n")
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        i += 1
+        tokens = line.split()
+        if not tokens:
+            continue
+        if len(tokens) > 1 and tokens[1] == "!":
+            if len(tokens) != 3:
+                raise ValueError("Invalid attribute specification.")
+            yield ("attribute", tokens[0], tokens[2])
+        elif len(tokens) > 1 and tokens[1] == "/":
+            if len(tokens) != 3:
+                raise ValueError("Invalid dependency specification.")
+            yield ("dependency", tokens[0], tokens[2])
+        else:
+            command = [line[len(tokens[0])+1:]]
+            for mark in _sentinels(line):
+                while True:
+                    if i == len(lines):
+                        raise ValueError("EOF reached while reading sentinel.")
+                    command.append(lines[i])
+                    i += 1
+                    if lines[i-1] == mark:
+                        break
+            yield ("symbol", tokens[0], "\n".join(command))
+
+#Yields the records of stream, which defaults to our standard input, in whichever framing it's in.
+def read_records(stream=None):
+    data = (stream or _stdin()).read()
+    if isinstance(data, str) and str is not bytes:
+        data = _encode(data)
+    if data[:1] == b"\0":
+        return _binary_records(data)
+    return _text_records(data)
+
+#Writes records to stream, which defaults to our standard output, in the binary framing if binary is set, which defaults to whether bake asked for it.
+class Writer:
+    def __init__(self, stream=None, binary=None):
+        self.stream = stream or _stdout()
+        self.binary = binary_requested() if binary is None else binary
+        if self.binary:
+            self.stream.write(MAGIC)
+
+    def _write(self, kind, first, second, text):
+        if self.binary:
+            first = _encode(first)
+            second = _encode(second)
+            self.stream.write(kind + struct.pack("<I", len(first)) + first + struct.pack("<I", len(second)) + second)
+        else:
+            self.stream.write(_encode(text))
+
+    def symbol(self, name, command):
+        self._write(b"S", name, command, name + " " + command.rstrip("\n") + "\n")
+
+    def dependency(self, dependency, dependent):
+        self._write(b"D", dependency, dependent, dependency + " / " + dependent + "\n")
+
+    def attribute(self, name, attribute):
+        self._write(b"A", name, attribute, name + " ! " + attribute + "\n")
@@ -0,0 +1,137 @@
+#include "jobserver.hpp"
+#include "StringFunctions.h"
+#include <csignal>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using std::getenv;
+using std::to_string;
+using std::vector;
+
+//While acquire() waits for a token, this is a duplicate of the jobserver read descriptor.
+//Our SIGCHLD handler closes it, so a child exiting between our check for exited children and our read() can't leave us blocked.
+//(This is the same trick GNU make uses.)
+static volatile sig_atomic_t interruptible_fd = -1;
+
+static void close_interruptible_fd(int signum)
+{
+     int fd = interruptible_fd;
+     interruptible_fd = -1;
+     if(fd!=-1)
+          close(fd);
+}
+
+bool Jobserver::join()
+{
+     const char* makeflags = getenv("MAKEFLAGS");
+     if(!makeflags)
+          return false;
+
+     //The last jobserver option wins, as it does in make.
+     vector<string> flags;
+     StringFunctions::tokenize(flags,makeflags);
+     string auth;
+     for(const string& flag : flags)
+          if(flag.find("--jobserver-auth=")==0)
+               auth = flag.substr(strlen("--jobserver-auth="));
+          else if(flag.find("--jobserver-fds=")==0)
+               auth = flag.substr(strlen("--jobserver-fds="));
+     if(auth=="")
+          return false;
+
+     if(auth.find("fifo:")==0)
+     {
+          read_fd = write_fd = open(auth.substr(strlen("fifo:")).c_str(),O_RDWR|O_CLOEXEC);
+          return read_fd!=-1;
+     }
+
+     //Pipe jobserver: make closes the descriptors for commands it doesn't think are recursive, so check that we really have them.
+     size_t comma = auth.find(',');
+     if(comma==string::npos)
+          return false;
+     int advertised_read = atoi(auth.substr(0,comma).c_str());
+     int advertised_write = atoi(auth.substr(comma+1).c_str());
+     if(fcntl(advertised_read,F_GETFD)==-1 || fcntl(advertised_write,F_GETFD)==-1)
+          return false;
+
+     read_fd = advertised_read;
+     write_fd = advertised_write;
+     return true;
+}
+
+void Jobserver::serve(int slots) throw(const char*)
+{
+     //Our children must inherit these, so no O_CLOEXEC here.
+     int fds[2];
+     if(pipe(fds)==-1)
+          throw "Unable to create jobserver pipe.";
+     read_fd = fds[0];
+     write_fd = fds[1];
+
+     //We keep one slot for ourselves.
+     string initial_tokens(slots-1,'+');
+     if(write(write_fd,initial_tokens.data(),initial_tokens.size())!=(ssize_t)initial_tokens.size())
+          throw "Unable to fill jobserver pipe.";
+
+     //Replace any jobserver our parent told us about with our own.
+     vector<string> flags;
+     const char* old_makeflags = getenv("MAKEFLAGS");
+     if(old_makeflags)
+          StringFunctions::tokenize(flags,old_makeflags);
+     string makeflags;
+     for(const string& flag : flags)
+          if(flag.find("-j")!=0 && flag.find("--jobserver-")!=0)
+               makeflags += flag+" ";
+     makeflags += "-j"+to_string(slots)+" --jobserver-auth="+to_string(read_fd)+","+to_string(write_fd);
+     setenv("MAKEFLAGS",makeflags.c_str(),1);
+}
+
+bool Jobserver::acquire()
+{
+     //Install a SIGCHLD handler without SA_RESTART, so a child exiting interrupts our read().
+     struct sigaction action, old_action;
+     action.sa_handler = close_interruptible_fd;
+     sigemptyset(&action.sa_mask);
+     action.sa_flags = 0;
+     sigaction(SIGCHLD,&action,&old_action);
+     interruptible_fd = fcntl(read_fd,F_DUPFD_CLOEXEC,0);
+
+     //A child which exited before the handler was installed won't interrupt us, so look for one first.
+     char token;
+     bool got_token = false;
+     siginfo_t exited;
+     exited.si_pid = 0;
+     if(interruptible_fd!=-1 && waitid(P_ALL,0,&exited,WEXITED|WNOHANG|WNOWAIT)==0 && exited.si_pid==0)
+          got_token = read(interruptible_fd,&token,1)==1;
+
+     //Clean up with SIGCHLD blocked, so the handler can't close the descriptor out from under us.
+     sigset_t sigchld, old_mask;
+     sigemptyset(&sigchld);
+     sigaddset(&sigchld,SIGCHLD);
+     sigprocmask(SIG_BLOCK,&sigchld,&old_mask);
+     if(interruptible_fd!=-1)
+          close(interruptible_fd);
+     interruptible_fd = -1;
+     sigaction(SIGCHLD,&old_action,NULL);
+     sigprocmask(SIG_SETMASK,&old_mask,NULL);
+
+     if(got_token)
+          tokens += token;
+     return got_token;
+}
+
+void Jobserver::release()
+{
+     if(!tokens.size())
+          return;
+
+     char token = tokens[tokens.size()-1];
+     while(write(write_fd,&token,1)==-1 && errno==EINTR);
+     tokens.erase(tokens.size()-1);
+}
@@ -0,0 +1,42 @@
+#ifndef JOBSERVER_HPP
+#define JOBSERVER_HPP
+
+#include <string>
+
+using std::string;
+
+/*GNU make compatible jobserver.
+  Every process sharing a jobserver owns one implicit job slot, and must read a token from the jobserver pipe
+  before running each job beyond that, writing the token back once the job exits.
+  The pipe is advertised to child processes through MAKEFLAGS, so that recursive bakes and makes
+  draw from one global pool of slots.*/
+class Jobserver
+{
+public:
+     //Joins the jobserver advertised in MAKEFLAGS, if any.  Understands both pipe ("--jobserver-auth=R,W") and fifo ("--jobserver-auth=fifo:PATH") jobservers.
+     //Returns whether there was a usable one.
+     bool join();
+
+     //Creates a new jobserver with the passed number of slots (our own implicit one included) and advertises it to our children through MAKEFLAGS.
+     //Throws exception if the jobserver pipe cannot be created.
+     void serve(int slots) throw(const char*);
+
+     //Blocks until we have obtained a token or one of our children has exited.  Returns whether we got a token.
+     //Must only be called while we have children: otherwise, we'd wait forever on a jobserver with no free tokens.
+     bool acquire();
+
+     //Gives one of the tokens we hold back to the jobserver.
+     void release();
+
+     //Returns the number of tokens we hold.
+     int tokens_held() const { return tokens.size(); }
+
+private:
+     int read_fd = -1;
+     int write_fd = -1;
+
+     //The tokens we hold: make requires us to give back the same bytes we took
+     string tokens;
+};
+
+#endif
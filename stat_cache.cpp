@@ -0,0 +1,97 @@
+#include "stat_cache.hpp"
+#include "bake_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+
+using std::atomic;
+using std::make_pair;
+using std::max;
+using std::min;
+using std::pair;
+using std::thread;
+
+//Threads get paths from the shared list in batches of this many, to keep them from contending over it.
+static const size_t PREFETCH_BATCH = 256;
+
+//More threads than this stop helping even on network filesystems.
+static const long MAX_PREFETCH_THREADS = 32;
+
+StatCache::Status StatCache::stat_path(const string& path)
+{
+     Status to_return;
+     struct stat statbuf;
+     to_return.exists = stat(path.c_str(),&statbuf)==0;
+     if(to_return.exists)
+     {
+          to_return.mtime = statbuf.st_mtim;
+          to_return.size = statbuf.st_size;
+          to_return.inode = statbuf.st_ino;
+     }
+     else
+     {
+          to_return.mtime.tv_sec = to_return.mtime.tv_nsec = 0;
+          to_return.size = 0;
+          to_return.inode = 0;
+     }
+     return to_return;
+}
+
+void StatCache::prefetch(const vector<string>& paths)
+{
+     //Make room for each new path's status up front, so that a path given more than once is only stat()ed once.
+     vector<pair<const string*,Status*>> to_stat;
+     statuses.reserve(statuses.size()+paths.size());
+     for(const string& path : paths)
+     {
+          auto added = statuses.emplace(path,Status());
+          if(added.second)
+               to_stat.push_back(make_pair(&added.first->first,&added.first->second));
+     }
+
+     //The workers each take the next batch of paths until there are none left, each storing its results in its own paths' places, so they share nothing else.
+     BAKE_COUNT(STAT_CALLS,to_stat.size());
+     atomic<size_t> next_batch(0);
+     auto worker = [&]()
+          {
+               size_t begin;
+               while((begin = next_batch.fetch_add(PREFETCH_BATCH)) < to_stat.size())
+                    for(size_t i=begin; i<min(begin+PREFETCH_BATCH,to_stat.size()); i++)
+                         *to_stat[i].second = stat_path(*to_stat[i].first);
+          };
+
+     long thread_count = min(min(max(sysconf(_SC_NPROCESSORS_ONLN),1L)*4,MAX_PREFETCH_THREADS),(long)(to_stat.size()/PREFETCH_BATCH));
+     vector<thread> threads;
+     for(long i=1; i<thread_count; i++)
+          threads.emplace_back(worker);
+     worker(); //we're a worker, too
+     for(thread& x : threads)
+          x.join();
+}
+
+const StatCache::Status& StatCache::get(const string& path)
+{
+     auto cached = statuses.find(path);
+     if(cached!=statuses.end())
+          return cached->second;
+     BAKE_COUNT(STAT_CALLS,1);
+     return statuses.emplace(path,stat_path(path)).first->second;
+}
+
+bool StatCache::refresh(const string& path)
+{
+     BAKE_COUNT(STAT_CALLS,1);
+     Status status = stat_path(path);
+     auto cached = statuses.find(path);
+     if(cached==statuses.end())
+     {
+          statuses.emplace(path,status);
+          return true;
+     }
+     bool changed = !(cached->second==status);
+     cached->second = status;
+     return changed;
+}
@@ -0,0 +1,47 @@
+#ifndef STAT_CACHE_HPP
+#define STAT_CACHE_HPP
+
+#include "deplib.hpp"
+#include <ctime>
+#include <sys/types.h>
+
+//Status of files, so that each file is stat()ed once per run no matter how many targets depend on it.
+class StatCache
+{
+public:
+     struct Status
+     {
+          bool exists;
+          timespec mtime;
+          off_t size;
+          ino_t inode;
+
+          bool operator==(const Status& other) const
+          {
+               return exists==other.exists && mtime.tv_sec==other.mtime.tv_sec && mtime.tv_nsec==other.mtime.tv_nsec && size==other.size && inode==other.inode;
+          }
+
+          //Returns whether we were modified after other, to the nanosecond (or whatever the filesystem records).
+          bool newer_than(const Status& other) const
+          {
+               return mtime.tv_sec > other.mtime.tv_sec || (mtime.tv_sec==other.mtime.tv_sec && mtime.tv_nsec > other.mtime.tv_nsec);
+          }
+     };
+
+     /*Stats all of paths not already cached, spread across a number of threads.  A path may be given more than once.
+       Most of the time of a stat() on a cold cache or a network filesystem is spent waiting, so we use more threads than there are processors.*/
+     void prefetch(const vector<string>& paths);
+
+     //Returns status of path, stat()ing it if it isn't cached.
+     const Status& get(const string& path);
+
+     //Stats path again, replacing its cached status.  Returns whether the status changed.
+     bool refresh(const string& path);
+
+private:
+     static Status stat_path(const string& path);
+
+     unordered_map<string,Status> statuses;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "string_interner.hpp"
+#include <cstring>
+
+using std::memcmp;
+using std::memcpy;
+
+//Size of the arena's blocks; a string bigger than a quarter of one gets a block of its own.
+static const size_t BLOCK_SIZE = 64*1024;
+
+const StringInterner::Id StringInterner::NOT_FOUND;
+
+//FNV-1a: paths differ mostly near their ends, so every byte has to count.
+uint32_t StringInterner::hash(const char* data, size_t size)
+{
+     uint64_t to_return = 14695981039346656037ull;
+     for(size_t i=0; i<size; i++)
+          to_return = (to_return^static_cast<unsigned char>(data[i]))*1099511628211ull;
+     return to_return^(to_return>>32);
+}
+
+size_t StringInterner::find_slot(const char* data, size_t size, uint32_t hash) const
+{
+     size_t mask = slots.size()-1;
+     for(size_t slot = hash&mask; ; slot = (slot+1)&mask)
+     {
+          Id id = slots[slot];
+          if(id==NOT_FOUND)
+               return slot;
+          const Entry& entry = entries[id];
+          if(entry.hash==hash && entry.size==size && memcmp(entry.data,data,size)==0)
+               return slot;
+     }
+}
+
+const char* StringInterner::store(const char* data, size_t size)
+{
+     char* to_return;
+     if(size+1 > BLOCK_SIZE/4)
+     {
+          //Leave the current block to the strings after us.
+          blocks.emplace_back(new char[size+1]);
+          to_return = blocks.back().get();
+     }
+     else
+     {
+          if(size+1 > block_left)
+          {
+               blocks.emplace_back(new char[BLOCK_SIZE]);
+               block_next = blocks.back().get();
+               block_left = BLOCK_SIZE;
+          }
+          to_return = block_next;
+          block_next += size+1;
+          block_left -= size+1;
+     }
+     memcpy(to_return,data,size);
+     to_return[size] = '\0';
+     return to_return;
+}
+
+StringInterner::StringInterner(const StringInterner& other) : entries(other.entries), slots(other.slots), block_next(nullptr), block_left(0)
+{
+     //Entries and slots carry over as they are, so IDs do; only the strings have to move into our own arena.
+     for(Entry& entry : entries)
+          entry.data = store(entry.data,entry.size);
+}
+
+StringInterner& StringInterner::operator=(const StringInterner& other)
+{
+     if(this!=&other)
+          *this = StringInterner(other);
+     return *this;
+}
+
+StringInterner::StringInterner(StringInterner&& other) : entries(std::move(other.entries)), slots(std::move(other.slots)), blocks(std::move(other.blocks)), block_next(other.block_next), block_left(other.block_left)
+{
+     //A moved-from vector of slots may be empty, which find_slot() can't search.
+     other.clear();
+}
+
+StringInterner& StringInterner::operator=(StringInterner&& other)
+{
+     if(this!=&other)
+     {
+          entries = std::move(other.entries);
+          slots = std::move(other.slots);
+          blocks = std::move(other.blocks);
+          block_next = other.block_next;
+          block_left = other.block_left;
+          other.clear();
+     }
+     return *this;
+}
+
+StringInterner::Id StringInterner::intern(const string& x)
+{
+     uint32_t x_hash = hash(x.data(),x.size());
+     size_t slot = find_slot(x.data(),x.size(),x_hash);
+     if(slots[slot]!=NOT_FOUND)
+          return slots[slot];
+
+     Id id = entries.size();
+     entries.push_back(Entry{store(x.data(),x.size()),uint32_t(x.size()),x_hash});
+     slots[slot] = id;
+
+     //Double the table once it's half full, placing every ID anew.
+     if(entries.size()*2 > slots.size())
+     {
+          slots.assign(slots.size()*2,NOT_FOUND);
+          for(Id i=0; i<entries.size(); i++)
+               slots[find_slot(entries[i].data,entries[i].size,entries[i].hash)] = i;
+     }
+     return id;
+}
+
+StringInterner::Id StringInterner::find(const string& x) const
+{
+     return slots[find_slot(x.data(),x.size(),hash(x.data(),x.size()))];
+}
+
+void StringInterner::clear()
+{
+     entries.clear();
+     entries.shrink_to_fit();
+     slots.assign(16,NOT_FOUND);
+     slots.shrink_to_fit();
+     blocks.clear();
+     block_left = 0;
+}
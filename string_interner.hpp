@@ -0,0 +1,73 @@
+#ifndef STRING_INTERNER_HPP
+#define STRING_INTERNER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+/*Stores each distinct string once, in an arena of large blocks, and numbers them densely from 0 in the order they were first interned.
+  Lookups hash the bytes in place, so finding a string never copies it.
+  Strings are never removed one at a time: clear(), or our destruction, frees the whole arena at once.
+  A copy has an arena of its own, holding the same strings under the same IDs.  Moving from an interner leaves it empty, as clear() does.*/
+class StringInterner
+{
+public:
+     typedef uint32_t Id;
+     static const Id NOT_FOUND = -1;
+
+     StringInterner() : slots(16,NOT_FOUND), block_next(nullptr), block_left(0) {}
+     StringInterner(const StringInterner& other);
+     StringInterner(StringInterner&& other);
+     StringInterner& operator=(const StringInterner& other);
+     StringInterner& operator=(StringInterner&& other);
+
+     //Returns the ID of x, storing it if it's new.
+     Id intern(const string& x);
+
+     //Returns the ID of x, or NOT_FOUND if it was never interned.
+     Id find(const string& x) const;
+
+     //Accessors for the string with the passed ID, which must be less than count().  The pointer stays valid, and NUL-terminated, until clear().
+     const char* c_str(Id id) const { return entries[id].data; }
+     size_t size(Id id) const { return entries[id].size; }
+     string get(Id id) const { return string(entries[id].data,entries[id].size); }
+
+     //Returns how many strings are stored.
+     Id count() const { return entries.size(); }
+
+     //Forgets every string and frees the arena.
+     void clear();
+
+private:
+     struct Entry
+     {
+          const char* data;
+          uint32_t size;
+          uint32_t hash;
+     };
+
+     static uint32_t hash(const char* data, size_t size);
+
+     //Returns the slot holding the string, or the empty slot where it belongs.
+     size_t find_slot(const char* data, size_t size, uint32_t hash) const;
+
+     //Copies the string into the arena, NUL-terminated.
+     const char* store(const char* data, size_t size);
+
+     vector<Entry> entries;
+
+     //Open-addressed hash table of IDs, kept at most half full; its size is a power of two.
+     vector<Id> slots;
+
+     //The arena: strings are packed into the last block until it's full.
+     vector<unique_ptr<char[]>> blocks;
+     char* block_next;
+     size_t block_left;
+};
+
+#endif
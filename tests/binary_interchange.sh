@@ -0,0 +1,57 @@
+#!/bin/sh
+#Checks the binary framing of the Baker Interchange Format end to end through helpers/bakebin.py:
+#a name with a space makes it from one #bake-binary generator through bake to the next and gets built,
+#and a text generator after them is given the rest of the graph, with a warning, rather than bake failing.
+#Usage: sh tests/binary_interchange.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+HELPERS=$(cd "$(dirname "$0")/../helpers" && pwd)
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+command -v python3 > /dev/null || { echo "SKIP: no python3"; exit 0; }
+
+cat > first.py <<'EOF'
+import sys
+sys.path.insert(0, sys.argv[1])
+import bakebin
+out = bakebin.Writer()
+out.symbol("my file.o", "sh make_my_file.sh")
+out.dependency("src", "my file.o")
+EOF
+cat > second.py <<'EOF'
+import sys
+sys.path.insert(0, sys.argv[1])
+import bakebin
+records = list(bakebin.read_records())
+if ("symbol", "my file.o", "sh make_my_file.sh") not in records or ("dependency", "src", "my file.o") not in records:
+    sys.exit("second.py was given %r" % (records,))
+out = bakebin.Writer()
+out.symbol("out", "sh make_out.sh")
+out.dependency("my file.o", "out")
+EOF
+cat > third.py <<'EOF'
+import sys
+sys.path.insert(0, sys.argv[1])
+import bakebin
+records = list(bakebin.read_records())
+if ("symbol", "out", "sh make_out.sh") not in records or any("my file.o" in record for record in records):
+    sys.exit("third.py was given %r" % (records,))
+EOF
+echo 'cp src "my file.o"' > make_my_file.sh
+echo 'cat "my file.o" > out' > make_out.sh
+cat > Bakefile <<EOF
+#bake-binary
+python3 first.py $HELPERS
+#bake-binary
+python3 second.py $HELPERS
+python3 third.py $HELPERS
+EOF
+echo hello > src
+
+BAKE_NO_DAEMON=1 "$BAKE" > /dev/null 2> errors
+status=$?
+[ $status -eq 0 ] || { cat errors; echo "FAIL: bake exited with status $status"; exit 1; }
+grep -q 'warning: "my file.o"' errors || { cat errors; echo "FAIL: no warning about leaving \"my file.o\" out of text"; exit 1; }
+[ "$(cat out 2>/dev/null)" = hello ] || { echo "FAIL: out not built through \"my file.o\""; exit 1; }
+echo PASS
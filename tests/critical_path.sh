@@ -0,0 +1,50 @@
+#!/bin/sh
+#Checks that, given build times recorded in .bake_log, -j 1 starts the target heading the longest chain of builds first.
+#Usage: sh tests/critical_path.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+#job.sh NAME SECONDS notes NAME as started, then takes SECONDS to build it.
+cat > job.sh <<'EOF'
+echo $1 >> started
+sleep $2
+touch $1
+EOF
+#slow, then after_slow, is the longest chain; the rest take no time.
+#With no build times to go on, quick1 comes first, since more targets wait on it.
+cat > tree <<'EOF'
+slow / after_slow
+quick1 / quick2
+quick1 / quick3
+quick1 sh job.sh quick1 0
+quick2 sh job.sh quick2 0
+quick3 sh job.sh quick3 0
+slow sh job.sh slow 0.4
+after_slow sh job.sh after_slow 0
+EOF
+echo 'cat tree' > Bakefile
+
+#Builds everything from scratch with -j 1, leaving the order targets were started in in $order.
+run()
+{
+     rm -f quick1 quick2 quick3 slow after_slow started
+     BAKE_NO_DAEMON=1 "$BAKE" -j 1 > /dev/null || { echo "FAIL: bake exited with status $?"; exit 1; }
+     order=$(tr '\n' ' ' < started)
+}
+
+#The first run has no build times to go on; it records them.
+run
+case "$order" in
+     "quick1 "*) ;;
+     *) echo "FAIL: started \"$order\" with no build times, expected quick1 first"; exit 1 ;;
+esac
+[ -e .bake_log ] || { echo "FAIL: no .bake_log written"; exit 1; }
+run
+case "$order" in
+     "slow "*) ;;
+     *) echo "FAIL: started \"$order\", expected slow first"; exit 1 ;;
+esac
+echo PASS
@@ -0,0 +1,47 @@
+#!/bin/sh
+#Checks that bake --daemon runs a Bakefile whose commands don't declare their inputs again for every build, so that a new source file is built,
+#and that it goes by what a client building for itself wrote to .bake_log, rather than rebuilding what the client already did.
+#Usage: sh tests/daemon.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > gen.sh <<'EOF'
+echo run >> generated
+for f in *.c
+do
+     echo "${f%.c}.o sh compile.sh $f ${f%.c}.o $(cat version)"
+     echo "$f / ${f%.c}.o"
+done
+EOF
+echo 'echo $2 >> compiled; cp $1 $2' > compile.sh
+echo 1 > version
+echo 'sh gen.sh' > Bakefile
+echo a > a.c
+
+"$BAKE" --daemon 2> daemon.log &
+DAEMON=$!
+for i in $(seq 100)
+do
+     [ -S .bake.sock ] && break
+     sleep 0.05
+done
+[ -S .bake.sock ] || { echo "FAIL: daemon didn't start"; exit 1; }
+
+"$BAKE" > /dev/null || { echo "FAIL: first build exited with status $?"; exit 1; }
+[ -f a.o ] || { echo "FAIL: a.o not built"; exit 1; }
+echo b > b.c
+"$BAKE" > /dev/null || { echo "FAIL: second build exited with status $?"; exit 1; }
+[ -f b.o ] || { echo "FAIL: b.o, from a source file added after the daemon started, not built"; exit 1; }
+
+#The daemon, not the client, must have run the Bakefile: once on starting, and once per build.
+[ "$(wc -l < generated)" -eq 3 ] || { echo "FAIL: Bakefile run $(wc -l < generated) times, expected 3"; exit 1; }
+#A client with -j builds for itself, bringing a.o and b.o up to date with their new commands; the daemon mustn't build them again on an old .bake_log.
+echo 2 > version
+"$BAKE" -j 1 > /dev/null || { echo "FAIL: build of our own exited with status $?"; exit 1; }
+: > compiled
+"$BAKE" > /dev/null || { echo "FAIL: build after a build of our own exited with status $?"; exit 1; }
+[ -s compiled ] && { echo "FAIL: the daemon rebuilt $(tr '\n' ' ' < compiled)after a client had"; exit 1; }
+echo PASS
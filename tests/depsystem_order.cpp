@@ -0,0 +1,377 @@
+//Checks DepSystem's cycle detection and build order: cycle rejection, committing and aborting batches, dependency lists whose satisfier is shadowed or deleted,
+//and the order staying buildable through random additions and deletions, with and without dependency lists.
+//Also checks that cached dependency closures follow changes to the graph, that a copy of a DepSystem is independent of the original,
+//and that a DepSystem moved from is left empty but usable.
+//Built and run by tests/depsystem_order.sh.
+
+#include "../deplib.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+using std::cerr;
+using std::cout;
+using std::exit;
+using std::count;
+using std::find;
+using std::find_if;
+using std::mt19937;
+using std::uniform_int_distribution;
+
+static void check(bool condition, const string& what)
+{
+     if(!condition)
+     {
+          cerr << "FAIL: " << what << endl;
+          exit(1);
+     }
+}
+
+//Returns whether calling f throws.
+template<typename F> static bool throws(F f)
+{
+     try
+     {
+          f();
+     }
+     catch(const char* e)
+     {
+          return true;
+     }
+     return false;
+}
+
+//Checks that get_symbols() holds every symbol once, each after everything it directly depends on.
+static void check_order(const DepSystem& graph, const string& when)
+{
+     vector<string> order = graph.get_symbols();
+     unordered_map<string,size_t> positions;
+     for(size_t i=0; i<order.size(); i++)
+          check(positions.emplace(order[i],i).second,when+": "+order[i]+" ordered twice");
+     for(const string& symbol : order)
+          for(const string& dep : graph.get_direct_dependencies(symbol))
+               check(positions.count(dep) && positions[dep]<positions[symbol],when+": "+symbol+" ordered before its dependency "+dep);
+}
+
+//Returns whether to is reachable from from by following dependencies, found the slow way.
+static bool depends_on(const DepSystem& graph, const string& from, const string& to)
+{
+     vector<string> to_visit{from};
+     unordered_set<string> visited{from};
+     while(to_visit.size())
+     {
+          string current = to_visit.back();
+          to_visit.pop_back();
+          if(current==to)
+               return true;
+          for(const string& dep : graph.get_direct_dependencies(current))
+               if(visited.insert(dep).second)
+                    to_visit.push_back(dep);
+     }
+     return false;
+}
+
+static void test_cycle_rejection()
+{
+     DepSystem graph;
+     for(const char* name : {"a","b","c","d"})
+          graph.add_set_symbol(name,"");
+     graph.add_dependency("b","a");
+     graph.add_dependency("c","b");
+     graph.add_dependency("d","c");
+     check(throws([&]() { graph.add_dependency("a","d"); }),"a cycle of four was accepted");
+     check(!graph.has_dependency("a","d"),"a rejected edge was kept");
+     check(throws([&]() { graph.add_dependency("a","a"); }),"a symbol was allowed to depend on itself");
+     check(throws([&]() { graph.add_dependency_list({"x","d"},"a"); }),"a cycle through a dependency list was accepted");
+     check_order(graph,"after rejecting cycles");
+
+     //An edge against the order moves symbols around rather than failing.
+     graph.add_set_symbol("e","");
+     graph.add_dependency("a","e");
+     check_order(graph,"after adding an edge against the order");
+}
+
+static void test_batches()
+{
+     DepSystem graph;
+     graph.add_set_symbol("a","");
+
+     graph.begin_batch();
+     check(throws([&]() { graph.begin_batch(); }),"a batch was begun inside another");
+     graph.add_set_symbol("b","");
+     graph.add_set_symbol("c","");
+     graph.add_dependency("b","a");
+     graph.add_dependency("c","b");
+     graph.commit_batch();
+     check(graph.has_dependency("c","b"),"a committed batch lost an edge");
+     check_order(graph,"after committing a batch");
+
+     //A cyclic batch is undone as a whole, and every cycle is reported.
+     graph.begin_batch();
+     graph.add_set_symbol("d","");
+     graph.add_set_symbol("e","");
+     graph.add_dependency("a","c");
+     graph.add_dependency("d","e");
+     graph.add_dependency("e","d");
+     string error;
+     try
+     {
+          graph.commit_batch();
+     }
+     catch(const char* e)
+     {
+          error = e;
+     }
+     check(error!="","a cyclic batch was committed");
+     check(count(error.begin(),error.end(),'\n')==2,"not every cycle was reported, one per line: "+error);
+     check(!graph.has_symbol("d") && !graph.has_symbol("e"),"symbols of a cyclic batch were kept");
+     check(!graph.has_dependency("a","c"),"an edge of a cyclic batch was kept");
+     check(graph.has_dependency("c","b"),"undoing a cyclic batch removed an earlier edge");
+     check_order(graph,"after a cyclic batch");
+
+     graph.begin_batch();
+     graph.add_set_symbol("f","");
+     graph.add_dependency("f","c");
+     graph.abort_batch();
+     check(!graph.has_symbol("f"),"an aborted batch kept its symbol");
+     check_order(graph,"after aborting a batch");
+}
+
+//A symbol shadowing another in one dependency list mustn't hide that the other still satisfies a second list of the same symbol.
+static void test_shadowing()
+{
+     DepSystem graph;
+     graph.add_set_symbol("l","");
+     graph.add_set_symbol("x","");
+     graph.add_dependency_list({"k","d"},"l");
+     graph.add_dependency_list({"g","d"},"l");
+     graph.add_set_symbol("d","");
+     graph.add_set_symbol("g","");
+     check(throws([&]() { graph.add_dependency("d","l"); }),"a cycle through a dependency list still satisfied by a shadowed symbol was accepted");
+     check_order(graph,"after shadowing a symbol in one of two dependency lists");
+
+     //A list may name its satisfier twice; what it shadows is still the next symbol after both.
+     DepSystem twice;
+     twice.add_set_symbol("d","");
+     twice.add_set_symbol("l","");
+     twice.add_dependency_list({"g","g","d"},"l");
+     twice.add_set_symbol("g","");
+     check(twice.get_direct_dependents("d").empty(),"a symbol shadowed by one named twice in a list kept its dependent");
+     check(!throws([&]() { twice.add_dependency("d","l"); }),"an edge was rejected on account of a shadowed dependency list");
+     check_order(twice,"after shadowing a symbol with one named twice in a list");
+}
+
+//Deleting a symbol which satisfies several lists hands each to its successor before any of them is ordered.
+static void test_list_deletion()
+{
+     DepSystem graph;
+     for(const char* name : {"l","j","c","i"})
+          graph.add_set_symbol(name,"");
+     graph.add_dependency_list({"i","d","c"},"l");
+     graph.add_set_symbol("f","");
+     graph.add_dependency("j","l");
+     graph.add_dependency_list({"i","f","a"},"c");
+     graph.delete_symbol("i");
+     check_order(graph,"after deleting a symbol satisfying two lists");
+     vector<string> deps = graph.get_dependencies("j");
+     check(deps==vector<string>({"f","c","l"}),"j's dependencies after deleting a symbol satisfying two lists aren't f c l");
+
+     //A deleted symbol's own lists go with it.
+     graph.delete_symbol("l");
+     check(graph.get_direct_dependents("c").empty(),"a deleted symbol is still a dependent of what satisfied its list");
+     check_order(graph,"after deleting a symbol with a dependency list");
+}
+
+//Checks that get_dependencies(symbol), which is cached, holds exactly what symbol depends on, in build order, without symbol itself.
+static void check_closure(const DepSystem& graph, const string& symbol, const string& when)
+{
+     vector<string> closure = graph.get_dependencies(symbol);
+     unordered_map<string,size_t> positions;
+     for(size_t i=0; i<closure.size(); i++)
+          positions[closure[i]] = i;
+     check(!positions.count(symbol),when+": "+symbol+" is among its own dependencies");
+     for(const string& other : graph.get_symbols())
+          if(other!=symbol)
+               check(positions.count(other)==depends_on(graph,symbol,other),when+": dependencies of "+symbol+(positions.count(other) ? " include " : " lack ")+other);
+     for(const string& dep : closure)
+          for(const string& dep_dep : graph.get_direct_dependencies(dep))
+               check(positions[dep_dep]<positions[dep],when+": dependencies of "+symbol+" put "+dep+" before "+dep_dep);
+}
+
+//A cached closure must be dropped when something it reaches through a shadowed dependency list gains a dependency.
+static void test_closures()
+{
+     DepSystem graph;
+     graph.add_set_symbol("l","");
+     graph.add_set_symbol("x","");
+     graph.add_dependency_list({"k","d"},"l");
+     graph.add_dependency_list({"g","d"},"l");
+     graph.add_set_symbol("d","");
+     graph.add_set_symbol("g","");
+     check_closure(graph,"l","before adding an edge to a shadowed symbol");
+     graph.add_dependency("d","x");
+     check_closure(graph,"l","after adding an edge to a shadowed symbol");
+}
+
+//Adds and deletes symbols and edges at random, checking each addition against the slow way and the order after every change.
+static void test_random_changes()
+{
+     mt19937 random(12345);
+     const int NAME_COUNT = 40;
+     auto name = [](int i) { return "s"+to_string(i); };
+     uniform_int_distribution<int> pick_name(0,NAME_COUNT-1), pick_action(0,9);
+
+     DepSystem graph;
+     for(int step=0; step<4000; step++)
+     {
+          string from = name(pick_name(random)), to = name(pick_name(random));
+          int action = pick_action(random);
+          if(action<2)
+          {
+               if(graph.has_symbol(from))
+                    graph.delete_symbol(from);
+               else
+                    graph.add_set_symbol(from,"");
+          }
+          else if(action<3)
+          {
+               if(graph.has_symbol(from) && graph.has_symbol(to) && graph.has_dependency(from,to))
+                    graph.delete_dependency(from,to);
+          }
+          else if(graph.has_symbol(from) && graph.has_symbol(to) && !graph.has_dependency(from,to))
+          {
+               bool cyclic = depends_on(graph,to,from);
+               bool rejected = throws([&]() { graph.add_dependency(from,to); });
+               check(cyclic==rejected,"step "+to_string(step)+": adding "+from+" -> "+to+(cyclic ? " made a cycle" : " was rejected"));
+          }
+          check_order(graph,"step "+to_string(step));
+     }
+}
+
+//Returns whether anything in graph depends on itself, found the slow way.
+static bool cyclic(const DepSystem& graph)
+{
+     for(const string& symbol : graph.get_symbols())
+          for(const string& dep : graph.get_direct_dependencies(symbol))
+               if(depends_on(graph,dep,symbol))
+                    return true;
+     return false;
+}
+
+/*As test_random_changes(), but with dependency lists, whose satisfiers come and go as symbols are added and deleted.
+  Also checks a closure after every change, since get_dependencies() caches them.*/
+static void test_random_lists()
+{
+     mt19937 random(54321);
+     const int NAME_COUNT = 30;
+     auto name = [](int i) { return "s"+to_string(i); };
+     uniform_int_distribution<int> pick_name(0,NAME_COUNT-1), pick_action(0,9);
+
+     DepSystem graph;
+     for(int step=0; step<4000; step++)
+     {
+          string when = "step "+to_string(step);
+          string from = name(pick_name(random)), to = name(pick_name(random));
+          int action = pick_action(random);
+          if(action<4)
+          {
+               if(!graph.has_symbol(from))
+                    graph.add_set_symbol(from,"");
+               else
+               {
+                    //Deleting a symbol can hand its lists to symbols making a cycle, which leaves no order to check: start over.
+                    graph.delete_symbol(from);
+                    if(cyclic(graph))
+                    {
+                         graph.clear();
+                         continue;
+                    }
+               }
+          }
+          else if(action<7)
+          {
+               if(!graph.has_symbol(to))
+                    continue;
+               vector<string> deplist{from,name(pick_name(random)),name(pick_name(random))};
+               auto satisfier = find_if(deplist.begin(),deplist.end(),[&](const string& x) { return graph.has_symbol(x); });
+               bool makes_cycle = satisfier!=deplist.end() && (*satisfier==to || depends_on(graph,*satisfier,to));
+               bool rejected = throws([&]() { graph.add_dependency_list(deplist,to); });
+               check(makes_cycle==rejected,when+": adding a list to "+to+(makes_cycle ? " made a cycle" : " was rejected"));
+          }
+          else if(graph.has_symbol(from) && graph.has_symbol(to) && !graph.has_dependency(from,to))
+          {
+               bool makes_cycle = depends_on(graph,to,from);
+               bool rejected = throws([&]() { graph.add_dependency(from,to); });
+               check(makes_cycle==rejected,when+": adding "+from+" -> "+to+(makes_cycle ? " made a cycle" : " was rejected"));
+          }
+          check_order(graph,when);
+          if(graph.has_symbol(to))
+               check_closure(graph,to,when);
+
+          //Dependents are found through reverse entries, which must match the dependencies exactly.
+          for(const string& symbol : graph.get_symbols())
+          {
+               vector<string> dependents = graph.get_direct_dependents(symbol);
+               for(const string& other : graph.get_symbols())
+               {
+                    vector<string> deps = graph.get_direct_dependencies(other);
+                    bool depends = find(deps.begin(),deps.end(),symbol)!=deps.end();
+                    bool listed = find(dependents.begin(),dependents.end(),other)!=dependents.end();
+                    check(depends==listed,when+": "+other+(depends ? " isn't" : " is")+" among the dependents of "+symbol);
+               }
+          }
+     }
+}
+
+static void test_copies()
+{
+     DepSystem original;
+     original.add_set_symbol("a","");
+     original.add_set_symbol("b","build b");
+     original.add_dependency("b","a");
+
+     DepSystem copy(original);
+     {
+          //A copy outlives what it was copied from.
+          DepSystem temporary(original);
+          temporary.add_set_symbol("t","");
+          copy = temporary;
+     }
+     original.delete_symbol("a");
+     original.add_set_symbol("c","");
+     check(copy.has_symbol("a") && copy.has_symbol("t") && !copy.has_symbol("c"),"a copy changed with its original");
+     check(copy.get_value("b")=="build b" && copy.has_dependency("b","a"),"a copy lost a value or an edge");
+     copy.add_set_symbol("d","");
+     copy.add_dependency("d","b");
+     check(!original.has_symbol("d"),"an original changed with its copy");
+     check_order(copy,"in a copy");
+     check_order(original,"in an original after copying");
+
+     //Moving from a graph leaves it empty, but still usable.
+     DepSystem moved(std::move(copy));
+     check(moved.has_symbol("a") && moved.has_dependency("d","b"),"a moved graph lost a symbol or an edge");
+     check(!copy.has_symbol("a") && !copy.has_symbol("y"),"a moved-from graph kept a symbol");
+     copy.add_set_symbol("y","");
+     check(copy.has_symbol("y"),"a moved-from graph couldn't be added to");
+     DepSystem assigned;
+     assigned = std::move(moved);
+     check(assigned.has_symbol("a") && !moved.has_symbol("a"),"move assignment didn't move the graph");
+     moved.add_set_symbol("z","");
+     check(moved.has_symbol("z") && !assigned.has_symbol("z"),"a graph moved from by assignment couldn't be added to");
+     check_order(copy,"in a moved-from graph");
+     check_order(moved,"in a graph moved from by assignment");
+}
+
+int main()
+{
+     test_cycle_rejection();
+     test_batches();
+     test_shadowing();
+     test_list_deletion();
+     test_closures();
+     test_random_changes();
+     test_random_lists();
+     test_copies();
+     cout << "PASS" << endl;
+     return 0;
+}
@@ -0,0 +1,11 @@
+#!/bin/sh
+#Builds and runs tests/depsystem_order.cpp, which checks DepSystem's cycle detection and build order.
+#Usage: sh tests/depsystem_order.sh [C++ compiler, default g++]
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+"${1:-g++}" -std=gnu++11 -O2 -w -I"$SOURCE" "$SOURCE/tests/depsystem_order.cpp" "$SOURCE/StringFunctions.cpp" "$SOURCE/bake_stats.cpp" "$SOURCE/deplib.cpp" \
+     "$SOURCE/frozen_depsystem.cpp" "$SOURCE/string_interner.cpp" -o "$DIR/depsystem_order" || { echo "FAIL: test didn't compile"; exit 1; }
+"$DIR/depsystem_order"
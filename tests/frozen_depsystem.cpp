@@ -0,0 +1,76 @@
+//Checks FrozenDepSystem's build plans, including on a graph whose dependency lists left it cyclic, and so without a buildable order.
+//Built and run by tests/frozen_depsystem.sh.
+
+#include "../frozen_depsystem.hpp"
+#include <cstdlib>
+
+using std::cerr;
+using std::cout;
+using std::exit;
+
+static void check(bool condition, const string& what)
+{
+     if(!condition)
+     {
+          cerr << "FAIL: " << what << endl;
+          exit(1);
+     }
+}
+
+//Returns the names of the symbols in the build plan of name, or "throws" if getting it throws.
+static string plan(const FrozenDepSystem& graph, const string& name)
+{
+     string to_return;
+     try
+     {
+          for(FrozenDepSystem::Index symbol : graph.get_build_plan(graph.find_symbol(name)))
+               to_return += string(to_return.size() ? " " : "")+graph.get_name(symbol);
+     }
+     catch(const char* e)
+     {
+          return "throws";
+     }
+     return to_return;
+}
+
+static void test_plans()
+{
+     DepSystem tree;
+     for(const char* name : {"a","b","c","d"})
+          tree.add_set_symbol(name,"");
+     tree.add_dependency("b","a");
+     tree.add_dependency("c","b");
+     tree.add_dependency_list({"x","a"},"d");
+     FrozenDepSystem graph = tree.freeze();
+     for(FrozenDepSystem::Index i=0; i<graph.get_symbol_count(); i++)
+          graph.set_state(i,DepSystem::STALE);
+     check(plan(graph,"c")=="a b c","plan of c is \""+plan(graph,"c")+"\"");
+     check(plan(graph,"d")=="a d","plan of d is \""+plan(graph,"d")+"\"");
+     graph.set_state(graph.find_symbol("a"),DepSystem::VALID);
+     check(plan(graph,"c")=="b c","plan of c with a valid is \""+plan(graph,"c")+"\"");
+}
+
+/*z depends on a, and a on the first of y and z that exists.  Deleting y leaves a depending on z: a cycle, which DepSystem can't reject, so its build order goes stale.
+  Building either must fail cleanly, rather than the frozen graph trusting an order that doesn't hold.*/
+static void test_cycle_from_dependency_lists()
+{
+     DepSystem tree;
+     for(const char* name : {"y","z","a"})
+          tree.add_set_symbol(name,"");
+     tree.add_dependency_list({"y","z"},"a");
+     tree.add_dependency("z","a");
+     tree.delete_symbol("y");
+     FrozenDepSystem graph = tree.freeze();
+     for(FrozenDepSystem::Index i=0; i<graph.get_symbol_count(); i++)
+          graph.set_state(i,DepSystem::STALE);
+     check(plan(graph,"a")=="throws","plan of a, in a cycle, is \""+plan(graph,"a")+"\"");
+     check(plan(graph,"z")=="throws","plan of z, in a cycle, is \""+plan(graph,"z")+"\"");
+}
+
+int main()
+{
+     test_plans();
+     test_cycle_from_dependency_lists();
+     cout << "PASS" << endl;
+     return 0;
+}
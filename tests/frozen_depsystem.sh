@@ -0,0 +1,11 @@
+#!/bin/sh
+#Builds and runs tests/frozen_depsystem.cpp, which checks FrozenDepSystem's build plans.
+#Usage: sh tests/frozen_depsystem.sh [C++ compiler, default g++]
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+"${1:-g++}" -std=gnu++11 -O2 -w -I"$SOURCE" "$SOURCE/tests/frozen_depsystem.cpp" "$SOURCE/StringFunctions.cpp" "$SOURCE/bake_stats.cpp" "$SOURCE/deplib.cpp" \
+     "$SOURCE/frozen_depsystem.cpp" "$SOURCE/string_interner.cpp" -o "$DIR/frozen_depsystem" || { echo "FAIL: test didn't compile"; exit 1; }
+"$DIR/frozen_depsystem"
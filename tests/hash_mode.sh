@@ -0,0 +1,55 @@
+#!/bin/sh
+#Checks that bake --hash rebuilds a target when the contents of its dependencies change, and not when they're only touched,
+#while plain bake still goes by modification times.
+#Usage: sh tests/hash_mode.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > tree <<'EOF'
+a / out
+b / out
+out sh build_out.sh
+EOF
+echo 'echo out >> ran; cat a b > out' > build_out.sh
+echo 'cat tree' > Bakefile
+echo 1 > a
+echo 2 > b
+
+#Runs bake with the passed options, and checks whether out was built.
+run()
+{
+     : > ran
+     BAKE_NO_DAEMON=1 "$BAKE" $1 > /dev/null || { echo "FAIL: bake $1 exited with status $?"; exit 1; }
+     ran=$(cat ran)
+     if [ "$ran" != "$2" ]
+     then
+          echo "FAIL: $3: ran \"$ran\", expected \"$2\""
+          exit 1
+     fi
+}
+
+run --hash out "first run"
+run --hash "" "second run, nothing changed"
+sleep 0.01
+touch a b
+run --hash "" "after touching a and b"
+sleep 0.01
+echo 2b > b
+run --hash out "after changing b"
+run --hash "" "after changing b, again"
+
+#Changing a file and changing it back is no change at all.
+sleep 0.01
+echo changed > a
+sleep 0.01
+echo 1 > a
+run --hash "" "after changing a and changing it back"
+[ "$(cat out)" = "$(printf '1\n2b')" ] || { echo "FAIL: out holds \"$(cat out)\""; exit 1; }
+
+sleep 0.01
+touch a
+run "" out "after touching a, without --hash"
+echo PASS
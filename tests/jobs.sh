@@ -0,0 +1,61 @@
+#!/bin/sh
+#Checks that -j N bounds how many build commands run at once, that independent targets do run alongside each other,
+#and that a target is only started once everything it depends on has been built.
+#Usage: sh tests/jobs.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+#Each job notes how many jobs are running once it has started, including itself.
+cat > job.sh <<'EOF'
+mkdir running/$1
+ls running | wc -l >> counts
+sleep 0.3
+rmdir running/$1
+touch $1
+EOF
+cat > all.sh <<'EOF'
+for target in t1 t2 t3 t4 t5 t6
+do
+     [ -e $target ] || { echo "all started before $target was built" > order_error; exit 1; }
+done
+touch all
+EOF
+cat > tree <<'EOF'
+t1 / all
+t2 / all
+t3 / all
+t4 / all
+t5 / all
+t6 / all
+t1 sh job.sh t1
+t2 sh job.sh t2
+t3 sh job.sh t3
+t4 sh job.sh t4
+t5 sh job.sh t5
+t6 sh job.sh t6
+all sh all.sh
+EOF
+echo 'cat tree' > Bakefile
+
+#Builds everything with -j $1, and checks the most jobs running at once was between $2 and $1.
+run()
+{
+     rm -rf t? all counts running
+     mkdir running
+     BAKE_NO_DAEMON=1 "$BAKE" -j $1 > /dev/null || { echo "FAIL: bake -j $1 exited with status $?"; exit 1; }
+     [ -e order_error ] && { cat order_error; echo "FAIL: -j $1"; exit 1; }
+     [ -e all ] || { echo "FAIL: -j $1 didn't build all"; exit 1; }
+     most=$(sort -n counts | tail -n 1)
+     if [ "$most" -gt $1 ] || [ "$most" -lt $2 ]
+     then
+          echo "FAIL: -j $1 ran $most jobs at once"
+          exit 1
+     fi
+}
+
+run 1 1
+run 3 2
+echo PASS
@@ -0,0 +1,59 @@
+#!/bin/sh
+#Checks that bake -j N advertises its jobserver through MAKEFLAGS, and that a bake and a make run by its build commands
+#without -j of their own share its N slots: they run several jobs at once, but never more than N between them.
+#Usage: sh tests/jobserver.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+#Each job notes how many jobs are running once it has started, including itself.
+cat > job.sh <<'EOF'
+mkdir "$JOBS_DIR/running/$1"
+ls "$JOBS_DIR/running" | wc -l >> "$JOBS_DIR/counts"
+sleep 0.3
+rmdir "$JOBS_DIR/running/$1"
+touch $1
+EOF
+JOBS_DIR=$DIR
+export JOBS_DIR
+
+#The outer Bakefile's one target runs a bake, then a make, in their own directories.
+mkdir inner_bake inner_make
+cp job.sh inner_bake
+cp job.sh inner_make
+cat > inner_bake/tree <<'EOF'
+t1 sh job.sh t1
+t2 sh job.sh t2
+t3 sh job.sh t3
+t4 sh job.sh t4
+t5 sh job.sh t5
+t6 sh job.sh t6
+EOF
+echo 'cat tree' > inner_bake/Bakefile
+printf 'all: t1 t2 t3 t4 t5 t6\nt%%:\n\tsh job.sh $@\n' > inner_make/Makefile
+cat > outer.sh <<EOF
+echo "\$MAKEFLAGS" > makeflags
+cd inner_bake && "$BAKE" > /dev/null && cd .. || exit 1
+if command -v make > /dev/null
+then
+     make -s -C inner_make > /dev/null || exit 1
+fi
+touch outer
+EOF
+echo 'outer sh outer.sh' > tree
+echo 'cat tree' > Bakefile
+
+mkdir running
+BAKE_NO_DAEMON=1 "$BAKE" -j 3 > /dev/null || { echo "FAIL: bake exited with status $?"; exit 1; }
+[ -e outer ] || { echo "FAIL: outer not built"; exit 1; }
+grep -q -- '--jobserver-auth=' makeflags || { echo "FAIL: MAKEFLAGS was \"$(cat makeflags)\", with no --jobserver-auth"; exit 1; }
+[ -e inner_bake/t6 ] || { echo "FAIL: the inner bake didn't build its targets"; exit 1; }
+most=$(sort -n counts | tail -n 1)
+if [ "$most" -gt 3 ] || [ "$most" -lt 2 ]
+then
+     echo "FAIL: the inner bake and make ran $most jobs at once within bake -j 3"
+     exit 1
+fi
+echo PASS
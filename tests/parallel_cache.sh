@@ -0,0 +1,43 @@
+#!/bin/sh
+#Checks that the commands of a #bake-parallel group with different #bake-inputs are each cached under their own inputs.
+#Usage: sh tests/parallel_cache.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+echo 1 > in1
+echo 2 > in2
+cat > Bakefile <<'EOF'
+#bake-parallel
+#bake-inputs in1
+sh -c "echo one >> ran; echo in1"
+#bake-inputs in2
+sh -c "echo two >> ran; echo in2"
+#bake-end
+EOF
+
+#Runs bake, and checks the commands listed were the ones run.
+run()
+{
+     : > ran
+     BAKE_NO_DAEMON=1 "$BAKE" > /dev/null || { echo "FAIL: bake exited with status $?"; exit 1; }
+     ran=$(sort ran | tr '\n' ' ')
+     if [ "$ran" != "$1" ]
+     then
+          echo "FAIL: $2: ran \"$ran\", expected \"$1\""
+          exit 1
+     fi
+}
+
+run "one two " "first run"
+run "" "second run, nothing changed"
+sleep 0.01
+echo 2b > in2
+run "two " "after changing in2"
+run "" "after changing in2, again"
+sleep 0.01
+echo 1b > in1
+run "one " "after changing in1"
+echo PASS
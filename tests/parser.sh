@@ -0,0 +1,53 @@
+#!/bin/sh
+#Checks parsing of the text Baker Interchange Format: records indented with spaces and tabs, blank and whitespace-only lines,
+#commands spanning lines through one or two sentinels, with lines inside them looking like records,
+#and the error for a sentinel left open at the end of the input.
+#Usage: sh tests/parser.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+#A sentinel makes one argument of the lines up to it.  If "heredoc / bogus" were read as a record, heredoc would depend on a file nothing builds.
+printf '%s\n' \
+     '   src / heredoc' \
+     '		src / both' \
+     '' \
+     '  	  ' \
+     'heredoc sh -c <<END' \
+     "cat > heredoc <<'EOF'" \
+     'first line' \
+     'heredoc / bogus' \
+     'EOF' \
+     'END' \
+     '  both sh -c <<SCRIPT <<ARGUMENT' \
+     'printf "%s\n" "$0" > both' \
+     'SCRIPT' \
+     'but this' \
+     'ARGUMENT' \
+     ' heredoc / out' \
+     ' both / out' \
+     '	out / all' \
+     'out sh -c "cat heredoc both > out"' \
+     'all touch all' > tree
+echo 'cat tree' > Bakefile
+echo src > src
+
+BAKE_NO_DAEMON=1 "$BAKE" > /dev/null 2> errors
+status=$?
+[ $status -eq 0 ] || { cat errors; echo "FAIL: bake exited with status $status"; exit 1; }
+[ -e all ] || { echo "FAIL: all not built through the indented dependency on out"; exit 1; }
+[ "$(cat out)" = "$(printf 'first line\nheredoc / bogus\nbut this')" ] || { echo "FAIL: out holds \"$(cat out)\""; exit 1; }
+
+#src is an indented dependency of both commands spanning lines.
+sleep 0.01
+touch src
+rm out
+BAKE_NO_DAEMON=1 "$BAKE" out > /dev/null || { echo "FAIL: bake out exited with status $?"; exit 1; }
+[ heredoc -nt src ] && [ both -nt src ] || { echo "FAIL: heredoc and both weren't rebuilt after touching src"; exit 1; }
+
+printf 'late sh -c <<END\ntouch late\n' > tree
+BAKE_NO_DAEMON=1 "$BAKE" > /dev/null 2> errors && { echo "FAIL: an open sentinel was accepted"; exit 1; }
+grep -q 'EOF reached while reading sentinel' errors || { cat errors; echo "FAIL: no error about the open sentinel"; exit 1; }
+echo PASS
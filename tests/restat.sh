@@ -0,0 +1,65 @@
+#!/bin/sh
+#Checks that a restat target whose command rewrites it with the same contents, or leaves it untouched,
+#doesn't get what depends on it rebuilt, that one left untouched isn't rebuilt again until its dependencies next change,
+#and that one whose contents change does.
+#Usage: sh tests/restat.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+#rewritten always writes the first line of src; untouched writes it only if it differs.
+cat > tree <<'EOF'
+src / rewritten
+src / untouched
+rewritten / out1
+untouched / out2
+rewritten ! restat
+untouched ! restat
+rewritten sh make_rewritten.sh
+untouched sh make_untouched.sh
+out1 sh make_out.sh out1 rewritten
+out2 sh make_out.sh out2 untouched
+EOF
+echo 'echo rewritten >> ran; head -n 1 src > rewritten' > make_rewritten.sh
+echo 'echo untouched >> ran; head -n 1 src > new; cmp -s new untouched || mv new untouched' > make_untouched.sh
+echo 'echo $1 >> ran; cp $2 $1' > make_out.sh
+echo 'cat tree' > Bakefile
+printf 'one\ncomment\n' > src
+
+#Runs bake, and checks the commands listed were the ones run.
+run()
+{
+     : > ran
+     BAKE_NO_DAEMON=1 "$BAKE" > /dev/null || { echo "FAIL: bake exited with status $?"; exit 1; }
+     ran=$(sort ran | tr '\n' ' ')
+     if [ "$ran" != "$1" ]
+     then
+          echo "FAIL: $2: ran \"$ran\", expected \"$1\""
+          exit 1
+     fi
+}
+
+run "out1 out2 rewritten untouched " "first run"
+run "" "second run, nothing changed"
+
+#Only the comment changes, so neither restat target's contents do.
+sleep 0.01
+printf 'one\nanother comment\n' > src
+run "rewritten untouched " "after changing src but not its first line"
+
+#untouched is still older than src, but .bake_log remembers its command found it up to date, so nothing runs.
+run "" "after changing src but not its first line, again"
+
+#A change after that check runs untouched's command again, and it still cuts off out2.
+sleep 0.01
+printf 'one\nyet another comment\n' > src
+run "rewritten untouched " "after changing src but not its first line a second time"
+run "" "after changing src but not its first line a second time, again"
+
+sleep 0.01
+printf 'two\nanother comment\n' > src
+run "out1 out2 rewritten untouched " "after changing src's first line"
+[ "$(cat out1)" = two ] && [ "$(cat out2)" = two ] || { echo "FAIL: out1 and out2 hold \"$(cat out1)\" and \"$(cat out2)\""; exit 1; }
+echo PASS
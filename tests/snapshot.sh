@@ -0,0 +1,65 @@
+#!/bin/sh
+#Checks that a Bakefile whose commands' output is all reused has its graph loaded from the snapshot, restat attributes included, and that a damaged snapshot is ignored.
+#Usage: sh tests/snapshot.sh [path to bake, default ./bake]
+
+BAKE=$(cd "$(dirname "${1:-./bake}")" && pwd)/$(basename "${1:-./bake}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > gen.sh <<'EOF'
+echo "mid cp src mid"
+echo "src / mid"
+echo "mid ! restat"
+echo "out sh build_out.sh"
+echo "mid / out"
+EOF
+cat > build_out.sh <<'EOF'
+cat mid > out
+echo out >> ran
+EOF
+cat > Bakefile <<'EOF'
+#bake-inputs gen.sh
+sh gen.sh
+EOF
+echo 1 > src
+
+#Runs bake with a trace, checks what it ran, and checks whether it loaded the graph from the snapshot rather than parsing the output of gen.sh.
+run()
+{
+     : > ran
+     BAKE_NO_DAEMON=1 "$BAKE" --trace trace.json > /dev/null || { echo "FAIL: $3: bake exited with status $?"; exit 1; }
+     ran=$(cat ran | tr '\n' ' ')
+     if [ "$ran" != "$1" ]
+     then
+          echo "FAIL: $3: ran \"$ran\", expected \"$1\""
+          exit 1
+     fi
+     if grep -q '"parse"' trace.json
+     then
+          loaded=no
+     else
+          loaded=yes
+     fi
+     if [ "$loaded" != "$2" ]
+     then
+          echo "FAIL: $3: loaded snapshot: $loaded, expected $2"
+          exit 1
+     fi
+}
+
+run "out " no "first run"
+[ -f .bake_cache/.graph ] || { echo "FAIL: no snapshot saved"; exit 1; }
+run "" yes "second run, nothing changed"
+sleep 0.01
+touch src
+run "" yes "after touching src, which mid is restat on"
+sleep 0.01
+echo 2 > src
+run "out " yes "after changing src"
+head -c 60 .bake_cache/.graph > truncated && mv truncated .bake_cache/.graph
+sleep 0.01
+echo 3 > src
+run "out " no "with a truncated snapshot"
+[ "$(cat out)" = 3 ] || { echo "FAIL: out is \"$(cat out)\", expected 3"; exit 1; }
+echo PASS